@@ -0,0 +1,85 @@
+#include "arena.h"
+#include <stdlib.h>
+
+// every allocation is rounded up to this, so that anything can be stored
+#define ALIGNMENT (sizeof(max_align_t))
+#define align_up(x) (((x) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT)
+
+void initArena(Arena* arena, size_t chunk_size) {
+    arena -> head = NULL;
+    arena -> chunk_size = chunk_size;
+}
+
+// add a new chunk at the beginning of the chunk list
+// returns NULL if allocation failed
+static Chunk* newChunk(Arena* arena, size_t capacity) {
+    Chunk* chunk = (Chunk*)malloc(sizeof(Chunk) + capacity);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk -> used = 0;
+    chunk -> capacity = capacity;
+    chunk -> next = arena -> head;
+    arena -> head = chunk;
+    return chunk;
+}
+
+// hand out size bytes from the current chunk
+// if they don't fit, we start a new chunk (a bigger one if the request
+// alone doesn't fit in a standard chunk)
+void* arenaAlloc(Arena* arena, size_t size) {
+    size = align_up(size);
+    Chunk* chunk = arena -> head;
+    if (chunk == NULL || chunk -> capacity - chunk -> used < size) {
+        size_t capacity = arena -> chunk_size;
+        if (size > capacity) {
+            capacity = size;
+        }
+        chunk = newChunk(arena, capacity);
+        if (chunk == NULL) {
+            return NULL;
+        }
+    }
+    void* result = (char*)chunk -> data + chunk -> used;
+    chunk -> used += size;
+    return result;
+}
+
+// free all the chunks, which frees everything allocated from the arena
+void freeArena(Arena* arena) {
+    while (arena -> head != NULL) {
+        Chunk* toDel = arena -> head;
+        arena -> head = toDel -> next;
+        free(toDel);
+    }
+}
+
+void initSlab(Slab* slab, Arena* arena, size_t object_size) {
+    // a freed object has to be able to hold the free list pointer
+    if (object_size < sizeof(void*)) {
+        object_size = sizeof(void*);
+    }
+    slab -> arena = arena;
+    slab -> object_size = object_size;
+    slab -> free_list = NULL;
+}
+
+// reuse a freed object if there is one, otherwise take memory from the arena
+void* slabAlloc(Slab* slab) {
+    if (slab -> free_list != NULL) {
+        void* result = slab -> free_list;
+        slab -> free_list = *(void**)result;
+        return result;
+    }
+    return arenaAlloc(slab -> arena, slab -> object_size);
+}
+
+// put the object on the free list, the memory goes back to the system
+// only when the whole arena is freed
+void slabFree(Slab* slab, void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    *(void**)ptr = slab -> free_list;
+    slab -> free_list = ptr;
+}
@@ -0,0 +1,44 @@
+// A bump allocator (arena) with:
+// - allocation in amortized constant time
+// - freeing of everything that was allocated in one go
+// and a slab on top of it that recycles objects of one fixed size
+
+#ifndef ARENA_H
+
+#include <stddef.h>
+
+// definition of a single block of memory the arena hands out from
+typedef struct Chunk {
+    struct Chunk *next;
+    size_t used;
+    size_t capacity;
+    max_align_t data[];
+} Chunk;
+
+// definition of the arena
+typedef struct {
+    Chunk *head;
+    size_t chunk_size;
+} Arena;
+
+// definition of the slab - freed objects are kept on a list
+// and handed out again before new memory is taken from the arena
+typedef struct {
+    Arena *arena;
+    size_t object_size;
+    void *free_list;
+} Slab;
+
+void initArena(Arena* arena, size_t chunk_size);
+// arenaAlloc returns NULL if allocation failed
+void* arenaAlloc(Arena* arena, size_t size);
+void freeArena(Arena* arena);
+
+void initSlab(Slab* slab, Arena* arena, size_t object_size);
+// slabAlloc returns NULL if allocation failed
+void* slabAlloc(Slab* slab);
+void slabFree(Slab* slab, void* ptr);
+
+#define ARENA_H
+
+#endif //ARENA_H
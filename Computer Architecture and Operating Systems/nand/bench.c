@@ -0,0 +1,230 @@
+// Benchmark of the library on generated circuits
+// usage: ./bench [-m] [layered [gates] [depth] [fan-in] [skew] [max threads]]
+//        ./bench [-m] adder [bits] [vectors]
+//        ./bench [-m] multiplier [bits] [vectors]
+// measures the build time, the memory per gate, the evaluation time per vector
+// (with nand_evaluate and with a compiled netlist) and the teardown time;
+// layered circuits are also evaluated with 1, 2, 4, ... threads, and the
+// results of adders and multipliers are checked against the arithmetic.
+// With -m every gate is created with nand_new instead of in a nand_circuit.
+
+#include "nand.h"
+#include "nand_circuit.h"
+#include "nand_parallel.h"
+#include "nand_netlist.h"
+#include "generator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#define SIGNALS 1024
+
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define SEED 88172645463325252ULL
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// peak resident memory in bytes
+static size_t peak_memory(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (size_t)usage.ru_maxrss * 1024;
+}
+
+static size_t argument(int argc, char *argv[], int idx, size_t otherwise) {
+    return idx < argc ? strtoull(argv[idx], NULL, 10) : otherwise;
+}
+
+// the value of bits first, ..., first + count - 1 of the results as a number
+static uint64_t number(const bool *bits, size_t count) {
+    uint64_t value = 0;
+    for (size_t idx = count; idx-- > 0;) {
+        value = value << 1 | bits[idx];
+    }
+    return value;
+}
+
+// the sum or the product of the numbers on the signals,
+// or -1 if the circuit is too wide to check
+static int64_t expected_value(const Generated *gen, const char *kind, size_t bits) {
+    if (strcmp(kind, "layered") == 0 || bits > 31) {
+        return -1;
+    }
+    uint64_t a = number(gen->signals, bits);
+    uint64_t b = number(gen->signals + bits, bits);
+    return strcmp(kind, "adder") == 0 ? a + b + gen->signals[2 * bits] : a * b;
+}
+
+// evaluates the outputs for `vectors` random values of the signals
+// with nand_evaluate and with the compiled netlist
+static int evaluate_vectors(Generated *gen, const char *kind, size_t bits, size_t vectors) {
+    int result_code = -1;
+    nand_netlist_t *net = NULL;
+    bool *result = (bool*)malloc(max(gen->output_count, 1) * sizeof(bool));
+    bool *compiled = (bool*)malloc(max(gen->output_count, 1) * sizeof(bool));
+    bool const **slots = (bool const**)malloc(max(gen->signal_count, 1) * sizeof(bool*));
+    if (result == NULL || compiled == NULL || slots == NULL) {
+        perror("bench");
+        goto done;
+    }
+    for (size_t idx = 0; idx < gen->signal_count; ++idx) {
+        slots[idx] = &gen->signals[idx];
+    }
+
+    double start = now();
+    net = nand_netlist_new(gen->outputs, gen->output_count, slots, gen->signal_count);
+    if (net == NULL) {
+        perror("bench");
+        goto done;
+    }
+    printf("compiled the netlist in %.3f s\n", now() - start);
+
+    uint64_t state = SEED;
+    double evaluate = 0;
+    double netlist = 0;
+    for (size_t v = 0; v < vectors; ++v) {
+        for (size_t idx = 0; idx < gen->signal_count; ++idx) {
+            gen->signals[idx] = next_random(&state) & 1;
+        }
+        start = now();
+        ssize_t length = nand_evaluate(gen->outputs, result, gen->output_count);
+        evaluate += now() - start;
+        start = now();
+        ssize_t compiled_length = nand_netlist_evaluate(net, NULL, compiled);
+        netlist += now() - start;
+
+        int64_t expected = expected_value(gen, kind, bits);
+        if (length == -1 || length != compiled_length ||
+            memcmp(result, compiled, gen->output_count * sizeof(bool)) != 0 ||
+            (expected != -1 && number(result, gen->output_count) != (uint64_t)expected)) {
+            fprintf(stderr, "MISMATCH in vector %zu\n", v);
+            goto done;
+        }
+    }
+    printf("nand_evaluate:              %.3f ms per vector (%zu vectors)\n",
+           evaluate * 1e3 / vectors, vectors);
+    printf("nand_netlist_evaluate:      %.3f ms per vector\n", netlist * 1e3 / vectors);
+    result_code = 0;
+
+done:
+    nand_netlist_delete(net);
+    free(result);
+    free(compiled);
+    free(slots);
+    return result_code;
+}
+
+// compares nand_evaluate with nand_evaluate_parallel for 1, 2, 4, ... threads
+static int evaluate_threads(Generated *gen, long max_threads) {
+    int result_code = -1;
+    bool *expected = (bool*)malloc(max(gen->output_count, 1) * sizeof(bool));
+    bool *result = (bool*)malloc(max(gen->output_count, 1) * sizeof(bool));
+    if (expected == NULL || result == NULL) {
+        perror("bench");
+        goto done;
+    }
+
+    double start = now();
+    ssize_t expected_length = nand_evaluate(gen->outputs, expected, gen->output_count);
+    double sequential = now() - start;
+    printf("nand_evaluate:              %.3f s (critical path %zd)\n",
+           sequential, expected_length);
+
+    for (unsigned threads = 1; threads <= (unsigned)max_threads; threads *= 2) {
+        start = now();
+        ssize_t length = nand_evaluate_parallel(gen->outputs, result, gen->output_count, threads);
+        double elapsed = now() - start;
+        bool same = length == expected_length &&
+                    memcmp(result, expected, gen->output_count * sizeof(bool)) == 0;
+        printf("nand_evaluate_parallel %3u: %.3f s (speedup %.2f)%s\n", threads,
+               elapsed, sequential / elapsed, same ? "" : " MISMATCH");
+        if (!same) {
+            goto done;
+        }
+    }
+    result_code = 0;
+
+done:
+    free(expected);
+    free(result);
+    return result_code;
+}
+
+static int usage(char *name) {
+    fprintf(stderr, "usage: %s [-m] [layered [gates] [depth] [fan-in] [skew] [max threads]]\n"
+                    "       %s [-m] adder [bits] [vectors]\n"
+                    "       %s [-m] multiplier [bits] [vectors]\n", name, name, name);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    int arg = 1;
+    bool use_circuit = true;
+    if (arg < argc && strcmp(argv[arg], "-m") == 0) {
+        use_circuit = false;
+        ++arg;
+    }
+    const char *kind = arg < argc ? argv[arg++] : "layered";
+
+    Generated gen;
+    size_t bits = 0;
+    size_t vectors = 1;
+    long max_threads = 0;
+    size_t memory = peak_memory();
+    double start = now();
+    int built;
+    if (strcmp(kind, "layered") == 0) {
+        size_t gates = argument(argc, argv, arg, 10000000);
+        size_t depth = argument(argc, argv, arg + 1, 100);
+        unsigned fan_in = argument(argc, argv, arg + 2, 2);
+        unsigned skew = argument(argc, argv, arg + 3, 1);
+        max_threads = arg + 4 < argc ? strtol(argv[arg + 4], NULL, 10)
+                                     : sysconf(_SC_NPROCESSORS_ONLN);
+        built = generate_layered(&gen, use_circuit, gates, depth, fan_in, skew, SIGNALS, SEED);
+        if (built == 0) {
+            printf("built %zu gates (%zu layers, fan-in %u, skew %u)",
+                   gen.gate_count, depth, fan_in, skew);
+        }
+    }
+    else if (strcmp(kind, "adder") == 0 || strcmp(kind, "multiplier") == 0) {
+        bits = argument(argc, argv, arg, strcmp(kind, "adder") == 0 ? 100000 : 128);
+        vectors = argument(argc, argv, arg + 1, 10);
+        if (vectors == 0) {
+            return usage(argv[0]);
+        }
+        built = strcmp(kind, "adder") == 0 ? generate_adder(&gen, use_circuit, bits)
+                                           : generate_multiplier(&gen, use_circuit, bits);
+        if (built == 0) {
+            printf("built %zu gates (%zu-bit %s)", gen.gate_count, bits, kind);
+        }
+    }
+    else {
+        return usage(argv[0]);
+    }
+    if (built == -1) {
+        perror("bench");
+        return usage(argv[0]);
+    }
+    printf(" in %.3f s%s\n", now() - start, use_circuit ? "" : " with nand_new");
+    printf("memory:                     %.1f bytes per gate\n",
+           (double)(peak_memory() - memory) / gen.gate_count);
+
+    if (evaluate_vectors(&gen, kind, bits, vectors) == -1 ||
+        (strcmp(kind, "layered") == 0 && evaluate_threads(&gen, max_threads) == -1)) {
+        free_generated(&gen);
+        return 1;
+    }
+
+    start = now();
+    free_generated(&gen);
+    printf("teardown:                   %.3f s\n", now() - start);
+    return 0;
+}
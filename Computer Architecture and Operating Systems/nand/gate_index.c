@@ -0,0 +1,109 @@
+#include "gate_index.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <errno.h>
+
+// at most this many blocks, so that every index fits in 32 bits
+#define MAX_BLOCKS (UINT32_MAX / INDEX_BLOCK)
+
+// the blocks given back by the pools, handed out again before new ones
+static pthread_mutex_t block_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t *free_blocks;
+static size_t free_block_count, free_block_capacity;
+// blocks handed out so far - read without the mutex by index_bound
+static atomic_uint_fast32_t block_count;
+
+void index_pool_init(IndexPool *pool) {
+    pool->free = NULL;
+    pool->free_count = 0;
+    pool->next = 0;
+    pool->end = 0;
+    pool->blocks = NULL;
+    pool->block_count = 0;
+    pool->block_capacity = 0;
+}
+
+// takes a block for the pool, growing its arrays first
+// returns -1 if allocation failed or there are no blocks left
+static int take_block(IndexPool *pool) {
+    if (pool->block_count == pool->block_capacity) {
+        size_t capacity = pool->block_capacity == 0 ? 1 : 2 * pool->block_capacity;
+        uint32_t *blocks = (uint32_t*)realloc(pool->blocks, capacity * sizeof(uint32_t));
+        if (blocks == NULL) {
+            return -1;
+        }
+        pool->blocks = blocks;
+        uint32_t *free_ = (uint32_t*)realloc(pool->free,
+                                             capacity * INDEX_BLOCK * sizeof(uint32_t));
+        if (free_ == NULL) {
+            return -1;
+        }
+        pool->free = free_;
+        pool->block_capacity = capacity;
+    }
+
+    pthread_mutex_lock(&block_mutex);
+    uint32_t block;
+    if (free_block_count > 0) {
+        block = free_blocks[--free_block_count];
+    }
+    else {
+        uint32_t total = atomic_load_explicit(&block_count, memory_order_relaxed);
+        // there is room to give every block back
+        if (total == MAX_BLOCKS || total == free_block_capacity) {
+            size_t capacity = free_block_capacity == 0 ? 64 : 2 * free_block_capacity;
+            uint32_t *tmp = total == MAX_BLOCKS ? NULL :
+                            (uint32_t*)realloc(free_blocks, capacity * sizeof(uint32_t));
+            if (tmp == NULL) {
+                pthread_mutex_unlock(&block_mutex);
+                return -1;
+            }
+            free_blocks = tmp;
+            free_block_capacity = capacity;
+        }
+        block = total;
+        atomic_store_explicit(&block_count, total + 1, memory_order_release);
+    }
+    pthread_mutex_unlock(&block_mutex);
+
+    pool->blocks[pool->block_count++] = block;
+    pool->next = block * INDEX_BLOCK;
+    pool->end = pool->next + INDEX_BLOCK;
+    return 0;
+}
+
+int index_pool_get(IndexPool *pool, uint32_t *index) {
+    if (pool->free_count > 0) {
+        *index = pool->free[--pool->free_count];
+        return 0;
+    }
+    if (pool->next == pool->end && take_block(pool) == -1) {
+        errno = ENOMEM;
+        return -1;
+    }
+    *index = pool->next++;
+    return 0;
+}
+
+void index_pool_put(IndexPool *pool, uint32_t index) {
+    pool->free[pool->free_count++] = index;
+}
+
+void index_pool_free(IndexPool *pool) {
+    if (pool->block_count > 0) {
+        pthread_mutex_lock(&block_mutex);
+        for (size_t idx = 0; idx < pool->block_count; ++idx) {
+            free_blocks[free_block_count++] = pool->blocks[idx];
+        }
+        pthread_mutex_unlock(&block_mutex);
+    }
+    free(pool->free);
+    free(pool->blocks);
+    index_pool_init(pool);
+}
+
+uint32_t index_bound(void) {
+    return (uint32_t)atomic_load_explicit(&block_count, memory_order_acquire) * INDEX_BLOCK;
+}
@@ -0,0 +1,42 @@
+// Dense indexes of the gates, so that plan_build can keep its marks
+// in a flat array indexed by them instead of looking the gates up.
+// Indexes are handed out in blocks to pools - every circuit has a pool
+// of its own and the gates created with nand_new share another one -
+// and a pool gives the indexes of deleted gates out again, so that
+// they stay below the number of gates that ever lived at the same time
+// (rounded up to whole blocks).
+
+#ifndef GATE_INDEX_H
+#define GATE_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// number of indexes in a block
+#define INDEX_BLOCK 4096
+
+typedef struct {
+    // indexes of deleted gates - there is room for all indexes
+    // of the pool, so that giving one back can't fail
+    uint32_t *free;
+    size_t free_count;
+    // the rest of the block indexes are taken from
+    uint32_t next, end;
+    // the blocks of the pool, given back by index_pool_free
+    uint32_t *blocks;
+    size_t block_count, block_capacity;
+} IndexPool;
+
+void index_pool_init(IndexPool *pool);
+// index_pool_get returns -1 (and sets errno to ENOMEM) if allocation failed
+// or all indexes are taken
+int index_pool_get(IndexPool *pool, uint32_t *index);
+void index_pool_put(IndexPool *pool, uint32_t index);
+// gives all blocks of the pool back, the indexes it handed out
+// must not be used any more
+void index_pool_free(IndexPool *pool);
+
+// every index handed out so far is below this
+uint32_t index_bound(void);
+
+#endif //GATE_INDEX_H
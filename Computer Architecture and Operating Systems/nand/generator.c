@@ -0,0 +1,236 @@
+#include "generator.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+// the other end of a gate input - either a gate or a signal
+typedef struct {
+    nand_t *gate;
+    bool *signal;
+} Wire;
+
+uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static int init_generated(Generated *gen, bool use_circuit, size_t gates,
+                          size_t signal_count, size_t output_count) {
+    memset(gen, 0, sizeof(Generated));
+    gen->gates = (nand_t**)malloc(max(gates, 1) * sizeof(nand_t*));
+    gen->signals = (bool*)calloc(max(signal_count, 1), sizeof(bool));
+    gen->outputs = (nand_t**)malloc(max(output_count, 1) * sizeof(nand_t*));
+    gen->signal_count = signal_count;
+    gen->output_count = output_count;
+    if (use_circuit) {
+        gen->circuit = nand_circuit_new();
+    }
+    if (gen->gates == NULL || gen->signals == NULL || gen->outputs == NULL ||
+        (use_circuit && gen->circuit == NULL)) {
+        free_generated(gen);
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+static nand_t* new_gate(Generated *gen, unsigned n) {
+    nand_t *g = gen->circuit != NULL ? nand_circuit_new_gate(gen->circuit, n) : nand_new(n);
+    if (g != NULL) {
+        gen->gates[gen->gate_count++] = g;
+    }
+    return g;
+}
+
+static int connect(Wire w, nand_t *g, unsigned k) {
+    return w.gate != NULL ? nand_connect_nand(w.gate, g, k) : nand_connect_signal(w.signal, g, k);
+}
+
+static Wire gate_wire(nand_t *g) {
+    return (Wire){.gate = g, .signal = NULL};
+}
+
+static Wire signal_wire(bool *s) {
+    return (Wire){.gate = NULL, .signal = s};
+}
+
+// a NAND of two wires
+static nand_t* nand2(Generated *gen, Wire x, Wire y) {
+    nand_t *g = new_gate(gen, 2);
+    if (g == NULL || connect(x, g, 0) == -1 || connect(y, g, 1) == -1) {
+        return NULL;
+    }
+    return g;
+}
+
+// the usual full adder of 9 NAND gates
+static int full_adder(Generated *gen, Wire a, Wire b, Wire c, Wire *sum, Wire *carry) {
+    nand_t *n1 = nand2(gen, a, b);
+    if (n1 == NULL) {
+        return -1;
+    }
+    nand_t *n2 = nand2(gen, a, gate_wire(n1));
+    nand_t *n3 = nand2(gen, b, gate_wire(n1));
+    if (n2 == NULL || n3 == NULL) {
+        return -1;
+    }
+    // a xor b
+    nand_t *x = nand2(gen, gate_wire(n2), gate_wire(n3));
+    if (x == NULL) {
+        return -1;
+    }
+    nand_t *n5 = nand2(gen, gate_wire(x), c);
+    if (n5 == NULL) {
+        return -1;
+    }
+    nand_t *n6 = nand2(gen, gate_wire(x), gate_wire(n5));
+    nand_t *n7 = nand2(gen, c, gate_wire(n5));
+    if (n6 == NULL || n7 == NULL) {
+        return -1;
+    }
+    nand_t *s = nand2(gen, gate_wire(n6), gate_wire(n7));
+    nand_t *cout = nand2(gen, gate_wire(n1), gate_wire(n5));
+    if (s == NULL || cout == NULL) {
+        return -1;
+    }
+    *sum = gate_wire(s);
+    *carry = gate_wire(cout);
+    return 0;
+}
+
+int generate_layered(Generated *gen, bool use_circuit, size_t gates, size_t depth,
+                     unsigned fan_in, unsigned skew, size_t signal_count, uint64_t seed) {
+    if (gen == NULL || depth == 0 || gates < depth || fan_in == 0 ||
+        skew == 0 || signal_count == 0 || seed == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t width = gates / depth;
+    if (init_generated(gen, use_circuit, width * depth, signal_count, width) == -1) {
+        return -1;
+    }
+    uint64_t state = seed;
+    for (size_t idx = 0; idx < signal_count; ++idx) {
+        gen->signals[idx] = next_random(&state) & 1;
+    }
+
+    for (size_t l = 0; l < depth; ++l) {
+        for (size_t idx = 0; idx < width; ++idx) {
+            nand_t *g = new_gate(gen, fan_in);
+            if (g == NULL) {
+                free_generated(gen);
+                return -1;
+            }
+            for (unsigned k = 0; k < fan_in; ++k) {
+                size_t choices = l == 0 ? signal_count : width;
+                size_t pick = next_random(&state) % choices;
+                for (unsigned draw = 1; draw < skew; ++draw) {
+                    size_t other = next_random(&state) % choices;
+                    pick = other < pick ? other : pick;
+                }
+                Wire w = l == 0 ? signal_wire(&gen->signals[pick])
+                                : gate_wire(gen->gates[(l - 1) * width + pick]);
+                if (connect(w, g, k) == -1) {
+                    free_generated(gen);
+                    return -1;
+                }
+            }
+        }
+    }
+    memcpy(gen->outputs, &gen->gates[(depth - 1) * width], width * sizeof(nand_t*));
+    return 0;
+}
+
+int generate_adder(Generated *gen, bool use_circuit, size_t bits) {
+    if (gen == NULL || bits == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (init_generated(gen, use_circuit, 9 * bits, 2 * bits + 1, bits + 1) == -1) {
+        return -1;
+    }
+    Wire carry = signal_wire(&gen->signals[2 * bits]);
+    for (size_t idx = 0; idx < bits; ++idx) {
+        Wire sum;
+        if (full_adder(gen, signal_wire(&gen->signals[idx]),
+                       signal_wire(&gen->signals[bits + idx]), carry, &sum, &carry) == -1) {
+            free_generated(gen);
+            return -1;
+        }
+        gen->outputs[idx] = sum.gate;
+    }
+    gen->outputs[bits] = carry.gate;
+    return 0;
+}
+
+int generate_multiplier(Generated *gen, bool use_circuit, size_t bits) {
+    if (gen == NULL || bits == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    // a constant false gate, bits^2 partial products of 2 gates
+    // and a full adder for each of them
+    if (init_generated(gen, use_circuit, 1 + 11 * bits * bits, 2 * bits, 2 * bits) == -1) {
+        return -1;
+    }
+    Wire *product = (Wire*)malloc(2 * bits * sizeof(Wire));
+    nand_t *zero = new_gate(gen, 0);
+    if (product == NULL || zero == NULL) {
+        free(product);
+        free_generated(gen);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (size_t idx = 0; idx < 2 * bits; ++idx) {
+        product[idx] = gate_wire(zero);
+    }
+
+    // row i adds a * b[i] shifted by i to the product; product[i + bits]
+    // is still zero before it, so it just takes the last carry
+    for (size_t i = 0; i < bits; ++i) {
+        Wire carry = gate_wire(zero);
+        for (size_t j = 0; j < bits; ++j) {
+            nand_t *not_and = nand2(gen, signal_wire(&gen->signals[j]),
+                                    signal_wire(&gen->signals[bits + i]));
+            nand_t *and = not_and == NULL ? NULL : new_gate(gen, 1);
+            if (and == NULL || nand_connect_nand(not_and, and, 0) == -1 ||
+                full_adder(gen, product[i + j], gate_wire(and), carry,
+                           &product[i + j], &carry) == -1) {
+                free(product);
+                free_generated(gen);
+                return -1;
+            }
+        }
+        product[i + bits] = carry;
+    }
+    for (size_t idx = 0; idx < 2 * bits; ++idx) {
+        gen->outputs[idx] = product[idx].gate;
+    }
+    free(product);
+    return 0;
+}
+
+// with a circuit, all the gates are freed at once,
+// otherwise they are deleted one by one
+void free_generated(Generated *gen) {
+    if (gen == NULL) {
+        return;
+    }
+    if (gen->circuit != NULL) {
+        nand_circuit_delete(gen->circuit);
+    }
+    else if (gen->gates != NULL) {
+        for (size_t idx = 0; idx < gen->gate_count; ++idx) {
+            nand_delete(gen->gates[idx]);
+        }
+    }
+    free(gen->gates);
+    free(gen->signals);
+    free(gen->outputs);
+    memset(gen, 0, sizeof(Generated));
+}
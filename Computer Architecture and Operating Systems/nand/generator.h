@@ -0,0 +1,50 @@
+// Deterministic circuit generators used by the benchmark.
+// The same parameters and seed always give the same circuit.
+
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nand.h"
+#include "nand_circuit.h"
+
+typedef struct {
+    // the circuit the gates were created in, or NULL if every gate
+    // was created with nand_new
+    nand_circuit_t *circuit;
+    nand_t **gates;
+    size_t gate_count;
+
+    // the signals the circuit reads, set by the caller before evaluation
+    bool *signals;
+    size_t signal_count;
+
+    nand_t **outputs;
+    size_t output_count;
+} Generated;
+
+// xorshift
+uint64_t next_random(uint64_t *state);
+
+// `depth` layers of gates/depth gates with `fan_in` inputs each; the first
+// layer reads `signal_count` signals and every other layer the one before it.
+// Inputs are picked as the minimum of `skew` uniform draws, so for skew > 1
+// the fan-out is concentrated on the first gates of every layer.
+// The outputs are the gates of the last layer.
+int generate_layered(Generated *gen, bool use_circuit, size_t gates, size_t depth,
+                     unsigned fan_in, unsigned skew, size_t signal_count, uint64_t seed);
+// a ripple-carry adder of two `bits`-bit numbers and a carry; the signals are
+// a[0..bits-1], b[0..bits-1], carry and the outputs are the sum bits
+// from the lowest, followed by the carry out
+int generate_adder(Generated *gen, bool use_circuit, size_t bits);
+// an array multiplier of two `bits`-bit numbers; the signals are
+// a[0..bits-1], b[0..bits-1] and the outputs are the 2 * bits product bits
+// from the lowest
+int generate_multiplier(Generated *gen, bool use_circuit, size_t bits);
+
+void free_generated(Generated *gen);
+
+#endif //GENERATOR_H
@@ -1,63 +1,242 @@
 #include "nand.h"
-#include "queue.h"
+#include "nand_internal.h"
 
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include <errno.h>
 
 
 #define max(a, b) ((a) > (b) ? (a) : (b))
 
-// typ - boolean signal or nand gate
-enum Type {
-    BOOL,
-    NAND
-};
-
-// logical value of the gate - evaluated, in-progress, or not yet
-// so in nand_evaluate, each gate's value is calculated only once
-enum OutputState {
-    EVALED,
-    EVALING,
-    NEVAL
-};
-
-// boolean signal treated as a kind of nand
-// therefore, I use a union here
-struct nand {
-    enum Type type;
-    union {
-        struct {
-            nand_t **input;
-            unsigned input_size;
-
-            enum OutputState state;
-            ssize_t critical_length;
-            bool output;
-
-            Queue* outputs;
-        };
-        bool* logic_val;
-    };
-};
+// the last generation given by nand_changed
+static atomic_ulong last_generation;
+
+// indexes of the gates created with nand_new
+static IndexPool heap_indexes;
+static pthread_mutex_t heap_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long new_generation(void) {
+    return atomic_fetch_add_explicit(&last_generation, 1, memory_order_relaxed) + 1;
+}
+
+// returns NULL if allocation failed
+static struct nand_group* new_group(void) {
+    struct nand_group *group = (struct nand_group*)malloc(sizeof(struct nand_group));
+    if (group != NULL) {
+        *group = (struct nand_group){NULL, 0, NULL, NULL, 0, 0};
+        group->plans_end = &group->plans;
+    }
+    return group;
+}
+
+// drops a reference to the group, freeing the groups nothing points at
+static void release_group(struct nand_group *group) {
+    while (group != NULL && --group->refs == 0) {
+        struct nand_group *parent = group->parent;
+        free(group);
+        group = parent;
+    }
+}
+
+static void join_group(nand_t *g, struct nand_group *group) {
+    g->group = group;
+    ++group->refs;
+    ++group->size;
+}
+
+// the root of the group of the gate, or NULL if it's in none yet
+// the gate points at the root directly afterwards, so that the next
+// lookup is short
+static struct nand_group* gate_group(nand_t *g) {
+    if (g->group == NULL) {
+        return NULL;
+    }
+    struct nand_group *root = g->group;
+    while (root->parent != NULL) {
+        root = root->parent;
+    }
+    if (root != g->group) {
+        ++root->refs;
+        release_group(g->group);
+        g->group = root;
+    }
+    return root;
+}
+
+// puts two gates created with nand_new, about to be connected, into one group
+// returns -1 if allocation failed and 0 otherwise
+static int merge_groups(nand_t *a, nand_t *b) {
+    struct nand_group *root_a = gate_group(a);
+    struct nand_group *root_b = gate_group(b);
+    if (root_a == NULL && root_b == NULL) {
+        if ((root_a = new_group()) == NULL) {
+            return -1;
+        }
+        join_group(a, root_a);
+        if (b != a) {
+            join_group(b, root_a);
+        }
+    }
+    else if (root_a == NULL) {
+        join_group(a, root_b);
+    }
+    else if (root_b == NULL) {
+        join_group(b, root_a);
+    }
+    else if (root_a != root_b) {
+        if (root_a->size < root_b->size) {
+            struct nand_group *tmp = root_a;
+            root_a = root_b;
+            root_b = tmp;
+        }
+        // the changes and plans of both groups are kept by the root
+        root_b->parent = root_a;
+        ++root_a->refs;
+        root_a->size += root_b->size;
+        root_a->generation = max(root_a->generation, root_b->generation);
+        if (root_b->plans != NULL) {
+            *root_a->plans_end = root_b->plans;
+            root_a->plans_end = root_b->plans_end;
+            root_b->plans = NULL;
+            root_b->plans_end = &root_b->plans;
+        }
+    }
+    return 0;
+}
+
+void nand_changed(nand_t *g) {
+    if (g->circuit != NULL) {
+        g->circuit->generation = new_generation();
+        plan_cache_free(&g->circuit->cache);
+    }
+    // a gate in no group isn't in the cones of any kept plan
+    else if (g->group != NULL) {
+        struct nand_group *group = gate_group(g);
+        group->generation = new_generation();
+        for (struct kept_plan *kept = group->plans; kept != NULL; kept = kept->next) {
+            plan_cache_free(&kept->cache);
+            kept->listed = false;
+        }
+        group->plans = NULL;
+        group->plans_end = &group->plans;
+    }
+}
+
+PlanCache* nand_plan(nand_t **g, size_t m, PlanCache *local) {
+    nand_circuit_t *circuit = g[0]->circuit;
+    for (size_t idx = 1; idx < m; ++idx) {
+        if (g[idx]->circuit != circuit) {
+            // nothing tracks changes of gates from different circuits together
+            return plan_cache_get(local, g, m, 0, 0) == -1 ? NULL : local;
+        }
+    }
+    // read before the generations of the gates, so that a plan
+    // is never newer than it says
+    unsigned long now = atomic_load_explicit(&last_generation, memory_order_relaxed);
+    if (circuit != NULL) {
+        PlanCache *cache = &circuit->cache;
+        return plan_cache_get(cache, g, m, circuit->generation, now) == -1 ? NULL : cache;
+    }
+
+    struct kept_plan *kept = g[0]->kept;
+    if (kept == NULL) {
+        kept = (struct kept_plan*)malloc(sizeof(struct kept_plan));
+        if (kept == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        plan_cache_init(&kept->cache);
+        kept->listed = false;
+        kept->next = NULL;
+        g[0]->kept = kept;
+    }
+    // the outputs need groups, so that their own changes are seen
+    unsigned long changed = 0;
+    struct nand_group *first = NULL;
+    for (size_t idx = 0; idx < m; ++idx) {
+        struct nand_group *group = gate_group(g[idx]);
+        if (group == NULL) {
+            if ((group = new_group()) == NULL) {
+                errno = ENOMEM;
+                return NULL;
+            }
+            join_group(g[idx], group);
+        }
+        changed = max(changed, group->generation);
+        if (idx == 0) {
+            first = group;
+        }
+    }
+    if (plan_cache_get(&kept->cache, g, m, changed, now) == -1) {
+        return NULL;
+    }
+    if (!kept->listed) {
+        kept->listed = true;
+        kept->next = NULL;
+        *first->plans_end = kept;
+        first->plans_end = &kept->next;
+    }
+    return &kept->cache;
+}
+
+// the plan kept by the last evaluation of the outputs g, never built here -
+// NULL (with errno set to EAGAIN) if there is none or gates changed since
+static const Plan* kept_plan(nand_t **g, size_t m) {
+    nand_circuit_t *circuit = g[0]->circuit;
+    for (size_t idx = 1; idx < m; ++idx) {
+        if (g[idx]->circuit != circuit) {
+            // plans of gates from different circuits aren't kept
+            errno = EAGAIN;
+            return NULL;
+        }
+    }
+    if (circuit != NULL) {
+        if (!plan_cache_valid(&circuit->cache, g, m, circuit->generation)) {
+            errno = EAGAIN;
+            return NULL;
+        }
+        return &circuit->cache.plan;
+    }
+
+    // every output of a kept plan has a group
+    unsigned long changed = 0;
+    for (size_t idx = 0; idx < m; ++idx) {
+        struct nand_group *group = gate_group(g[idx]);
+        if (group == NULL) {
+            errno = EAGAIN;
+            return NULL;
+        }
+        changed = max(changed, group->generation);
+    }
+    if (g[0]->kept == NULL || !plan_cache_valid(&g[0]->kept->cache, g, m, changed)) {
+        errno = EAGAIN;
+        return NULL;
+    }
+    return &g[0]->kept->cache.plan;
+}
 
 // creating a new gate
 nand_t* nand_new(unsigned n) {
-    // memory allocation
-    nand_t* new_nand = (nand_t*)malloc(sizeof(nand_t));
+    // memory allocation - the input array right after the gate,
+    // so that reading the gate brings its inputs along
+    nand_t* new_nand = (nand_t*)malloc(sizeof(nand_t) + n * sizeof(struct nand_input));
     if (new_nand == NULL) {
         errno = ENOMEM;
         return NULL;
     }
-    new_nand->input = (nand_t**)malloc(n * sizeof(nand_t*));
-    if (new_nand->input == NULL) {
+    new_nand->input = (struct nand_input*)(new_nand + 1);
+    Queue* queuePtr = newQueue();
+    if (queuePtr == NULL) {
         errno = ENOMEM;
         free(new_nand);
         return NULL;
     }
-    Queue* queuePtr = newQueue();
-    if (queuePtr == NULL) {
-        errno = ENOMEM;
-        free(new_nand->input);
+    pthread_mutex_lock(&heap_mutex);
+    int got_index = index_pool_get(&heap_indexes, &new_nand->index);
+    pthread_mutex_unlock(&heap_mutex);
+    if (got_index == -1) {
+        freeQueue(queuePtr);
         free(new_nand);
         return NULL;
     }
@@ -65,17 +244,45 @@ nand_t* nand_new(unsigned n) {
     // if allocations succeeded, fill the input array with nulls
     // and set other variables
     for (unsigned idx = 0; idx < n; ++idx) {
-        new_nand->input[idx] = NULL;
+        new_nand->input[idx] = (struct nand_input){NULL, new_nand, NULL, 0};
     }
     new_nand->outputs = queuePtr;
     new_nand->type = NAND;
-    new_nand->state = NEVAL;
     new_nand->input_size = n;
-    new_nand->output = false;
-    new_nand->critical_length = 0;
+    new_nand->circuit = NULL;
+    new_nand->kept = NULL;
+    new_nand->group = NULL;
     return new_nand;
 }
 
+// frees a signal wrapper connected to an input of the gate owner
+static void free_bool(nand_t *owner, nand_t *b) {
+    if (owner->circuit != NULL) {
+        slabFree(&owner->circuit->gates, b);
+    }
+    else {
+        free(b);
+    }
+}
+
+// clears the k-th input of the gate - the connection is removed
+// from the outputs of the gate on the other end through its node,
+// and a signal wrapper is freed since it's no longer needed
+static void disconnect(nand_t *g, unsigned k) {
+    struct nand_input *in = &g->input[k];
+    if (in->src == NULL) {
+        return;
+    }
+    if (in->src->type == NAND) {
+        removeNode(in->src->outputs, in->edge);
+    }
+    else {
+        free_bool(g, in->src);
+    }
+    in->src = NULL;
+    in->edge = NULL;
+}
+
 // deleting a gate
 void nand_delete(nand_t *g) {
     if (g == NULL) {
@@ -86,31 +293,39 @@ void nand_delete(nand_t *g) {
     if (g->type == BOOL) {
         return;
     }
-    // remove all occurrences of nodes in the outputs of input gates
+    nand_changed(g);
+    // disconnect the inputs, every one in constant time
     for (unsigned idx = 0; idx < g->input_size; ++idx) {
-        if (g -> input[idx] == NULL) {
-            continue;
-        }
-        else if (g->input[idx]->type == NAND) {
-            deleteNode(g->input[idx]->outputs, g);
-        }
-        else { // if g->input[idx]->type == BOOL
-            // free the boolean value since it's no longer needed
-            free(g->input[idx]);
-        }
-    }
-    // remove all occurrences of g from the input gates' outputs
-    for (ssize_t idx = 0; idx < g->outputs->size; ++idx) {
-        nand_t* tmp = iterQueue(g->outputs, idx);
-        for (unsigned j = 0; j < tmp->input_size; ++j) {
-            if (tmp->input[j] == g) {
-                tmp->input[j] = NULL;
-            }
-        }
+        disconnect(g, idx);
+    }
+    // clear the inputs g is connected to - the nodes of the outputs queue
+    // point at them directly
+    for (Node* node = g->outputs->front; node != NULL; node = node->next) {
+        struct nand_input *in = (struct nand_input*)node->val;
+        in->src = NULL;
+        in->edge = NULL;
+    }
+
+    // a gate from a circuit gives its nodes and itself back to the slabs,
+    // the input array and the queue are freed together with the circuit
+    if (g->circuit != NULL) {
+        clearQueue(g->outputs);
+        index_pool_put(&g->circuit->indexes, g->index);
+        slabFree(&g->circuit->gates, g);
+        return;
     }
 
-    // free memory for the gate, the outputs queue, and the input array
-    free(g->input);
+    // free memory for the gate (with the input array), the outputs queue and the plan,
+    // and give back its index and its place in the group
+    // (nand_changed took the plan off the list of the group)
+    if (g->kept != NULL) {
+        plan_cache_free(&g->kept->cache);
+        free(g->kept);
+    }
+    release_group(g->group);
+    pthread_mutex_lock(&heap_mutex);
+    index_pool_put(&heap_indexes, g->index);
+    pthread_mutex_unlock(&heap_mutex);
     freeQueue(g->outputs);
     free(g);
 }
@@ -127,31 +342,47 @@ int nand_connect_nand(nand_t *g_out, nand_t *g_in, unsigned k) {
         errno = EINVAL;
         return -1;
     }
+    // gates of different circuits (or a circuit and the heap) can't be mixed,
+    // because deleting a circuit would leave dangling pointers
+    if (g_in->circuit != g_out->circuit) {
+        errno = EINVAL;
+        return -1;
+    }
+    // connected gates created with nand_new share their generations
+    if (g_in->circuit == NULL && merge_groups(g_out, g_in) == -1) {
+        errno = ENOMEM;
+        return -1;
+    }
 
     // handle memory allocation failure
-    if (push(g_out->outputs, g_in) == -1) {
+    Node* edge = pushNode(g_out->outputs, &g_in->input[k]);
+    if (edge == NULL) {
         errno = ENOMEM;
         return -1;
     }
 
-    // clear the gate's input and remove one occurrence
-    // of the gate in the outputs of the gate that was on its k-th input
-    if (g_in->input[k] != NULL && g_in->input[k]->type == NAND) {
-        deleteNode(g_in->input[k]->outputs, g_in);
-    }
-    if (g_in->input[k] != NULL && g_in->input[k]->type == BOOL) {
-        free(g_in->input[k]);
-    }
+    // clear the gate's input, removing it from the outputs
+    // of the gate that was on its k-th input
+    disconnect(g_in, k);
 
-    g_in->input[k] = g_out;
+    g_in->input[k].src = g_out;
+    g_in->input[k].index = g_out->index;
+    g_in->input[k].edge = edge;
+    nand_changed(g_in);
 
     return 0;
 }
 
-// creates a boolean value
-nand_t* create_bool(bool* logic_val) {
+// creates a boolean value that will be connected to an input of the gate owner
+static nand_t* create_bool(nand_t *owner, bool* logic_val) {
     // memory allocation
-    nand_t* new_bool = (nand_t*)malloc(sizeof(nand_t));
+    nand_t* new_bool;
+    if (owner->circuit != NULL) {
+        new_bool = (nand_t*)slabAlloc(&owner->circuit->gates);
+    }
+    else {
+        new_bool = (nand_t*)malloc(sizeof(nand_t));
+    }
     if (new_bool == NULL) {
         return NULL;
     }
@@ -172,117 +403,18 @@ int nand_connect_signal(bool const *s, nand_t *g, unsigned k) {
         errno = EINVAL;
         return -1;
     }
-    nand_t* tmp = create_bool((bool*)s);
+    nand_t* tmp = create_bool(g, (bool*)s);
     if (tmp == NULL) {
         errno = ENOMEM;
         return -1;
     }
-    if (g->input[k] != NULL && g->input[k]->type == NAND) {
-        deleteNode(g->input[k]->outputs, g);
-    }
-    if (g->input[k] != NULL&&g->input[k]->type == BOOL) {
-        free(g->input[k]);
-    }
-    g->input[k] = tmp;
+    disconnect(g, k);
+    g->input[k].src = tmp;
+    g->input[k].index = SIGNAL_INDEX;
+    nand_changed(g);
     return 0;
 }
 
-// after nand_evaluate, we want to reset the state
-// of each gate we visited back to NEVAL
-void clear_eval(nand_t *g) {
-    // if we hit a null, a bool, or neval, it means
-    // either we reached the "beginning" of the gate graph
-    // or we've traversed an entire cycle if one existed
-    if (g == NULL || g->type == BOOL || g->state == NEVAL) {
-        return;
-    }
-
-    // set g->state to NEVAL and recursively clear gates
-    g->state = NEVAL;
-
-    for (unsigned idx = 0; idx < g->input_size; ++idx) {
-        clear_eval(g->input[idx]);
-    }
-}
-
-// struct to conveniently return the state of a gate (output + critical length)
-struct nand_state {
-    bool output;
-    ssize_t critical_length;
-};
-
-// recursively determines the critical path length of a given gate
-// (memoization recursion)
-struct nand_state nand_evaluate_rec(nand_t *g) {
-    struct nand_state result;
-
-    // base cases
-    // BOOL - we reached the "beginning of the graph"
-    // g->input_size == 0 - we hit a gate without inputs
-    // EVALED - a node that was calculated earlier
-    // EVALING - we hit a cycle
-
-    if (g->type == BOOL) {
-        result.output = *(g->logic_val);
-        result.critical_length = 1;
-        return result;
-    }
-    if (g->input_size == 0) {
-        g->state = EVALED;
-        result.output = false;
-        result.critical_length = 1;
-        return result;
-    }
-    if (g->state == EVALED) {
-        result.output = g->output;
-        result.critical_length = g->critical_length+1;
-        return result;
-    }
-    if (g->state == EVALING) {
-        errno = ECANCELED;
-        result.critical_length = -1;
-        return result;
-    }
-
-    // recursively determine the critical path length and logical values
-    result.critical_length = 0;
-    result.output = false;
-    g->state = EVALING;
-    for (unsigned idx = 0; idx < g->input_size; ++idx) {
-        // if we hit NULL in a gate's input, we can't calculate
-        if (g->input[idx] == NULL) {
-            errno = ECANCELED;
-            result.critical_length = -1;
-            return result;
-        }
-        struct nand_state eval_curr = nand_evaluate_rec(g->input[idx]);
-        // if the critical path length is -1, it means
-        // the critical path length calculation was interrupted, so we stop
-        if (eval_curr.critical_length == -1) {
-            result.critical_length = -1;
-            return result;
-        }
-        // otherwise, set the critical path length
-        // to the max of the critical path lengths of the input gates' outputs
-        result.critical_length = max(result.critical_length,
-                                     eval_curr.critical_length);
-        // calculate the logical value of the output
-        // (at least 1 false means the output is true)
-        if (!eval_curr.output) {
-            result.output = true;
-        }
-    }
-
-    // memoize the critical path length for the gate
-    g->critical_length = result.critical_length;
-    g->output = result.output;
-    g->state = EVALED;
-
-    // increase the critical path length by 1
-    ++result.critical_length;
-    return result;
-}
-
 // we calculate the critical path length and the logical values of the gates at the output
 ssize_t nand_evaluate(nand_t **g, bool *s, size_t m) {
     // we check the validity of the data
@@ -290,38 +422,87 @@ ssize_t nand_evaluate(nand_t **g, bool *s, size_t m) {
         errno = EINVAL;
         return -1;
     }
-    for (unsigned idx = 0; idx < m; ++idx) {
+    for (size_t idx = 0; idx < m; ++idx) {
         if (g[idx] == NULL) {
             errno = EINVAL;
             return -1;
         }
     }
 
-    // we call the recursive calculation of the critical path length and output
-    // for each gate in the array g
-    int max_ = 0;
-    for (unsigned idx = 0; idx < m; ++idx) {
-        struct nand_state eval_curr = nand_evaluate_rec(g[idx]);
-        if (eval_curr.critical_length == -1) {
-            // clear the gate states and return -1
-            for (unsigned idx = 0; idx < m; ++idx) {
-                clear_eval(g[idx]);
-            }
-            return -1;
-        }
-        s[idx] = eval_curr.output;
-        max_ = max(max_, eval_curr.critical_length - 1);
+    // the gates of the cones are numbered in topological order once,
+    // and evaluated with a single pass over the plan's arrays
+    // until some gate changes
+    PlanCache local;
+    plan_cache_init(&local);
+    PlanCache *cache = nand_plan(g, m, &local);
+    if (cache == NULL) {
+        return -1;
     }
+    const Plan *plan = &cache->plan;
+    plan_read_signals(plan, cache->signal_values);
+    plan_evaluate_range(plan, cache->signal_values, cache->values, 0, plan->size);
 
-    // clear the gate states
-    for (unsigned idx = 0; idx < m; ++idx) {
-        clear_eval(g[idx]);
+    ssize_t max_ = 0;
+    for (size_t idx = 0; idx < m; ++idx) {
+        s[idx] = cache->values[plan->outputs[idx]];
+        max_ = max(max_, (ssize_t)plan->critical_length[plan->outputs[idx]]);
     }
+    plan_cache_free(&local);
 
     // return the maximum length of the critical paths
     return max_;
 }
 
+static bool valid_outputs(nand_t **g, size_t m) {
+    if (m <= 0 || g == NULL) {
+        return false;
+    }
+    for (size_t idx = 0; idx < m; ++idx) {
+        if (g[idx] == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the critical path lengths of the kept plan lead along a longest path,
+// so it's read off them without another traversal of the gates
+ssize_t nand_critical_path(nand_t **g, size_t m, nand_t **path, size_t len) {
+    if (!valid_outputs(g, m) || (path == NULL && len > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    const Plan *plan = kept_plan(g, m);
+    if (plan == NULL) {
+        return -1;
+    }
+    size_t count = 0;
+    for (uint32_t curr = plan_path_start(plan); curr != SIGNAL_BIT;
+         curr = plan_path_next(plan, curr)) {
+        if (count < len) {
+            path[count] = plan->gates[curr];
+        }
+        ++count;
+    }
+    return count;
+}
+
+// the gates of the kept plan are numbered by level
+ssize_t nand_depth_histogram(nand_t **g, size_t m, size_t *counts, size_t len) {
+    if (!valid_outputs(g, m) || (counts == NULL && len > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    const Plan *plan = kept_plan(g, m);
+    if (plan == NULL) {
+        return -1;
+    }
+    for (uint32_t level = 0; level < plan->level_count && level < len; ++level) {
+        counts[level] = plan->level_offset[level + 1] - plan->level_offset[level];
+    }
+    return plan->level_count;
+}
+
 // number of gates connected to the output
 ssize_t nand_fan_out(nand_t const *g) {
     // check data validity
@@ -341,23 +522,25 @@ void* nand_input(nand_t const *g, unsigned k) {
         errno = EINVAL;
         return NULL;
     }
-    if (g->input[k] == NULL) {
+    nand_t* in = g->input[k].src;
+    if (in == NULL) {
         errno = 0;
         return NULL;
     }
     // if the gate at the k-th input is a bool, we return a pointer to the bool
     // that the pointer in the struct points to
-    if (g->input[k]->type == BOOL) {
-        return g->input[k]->logic_val;
+    if (in->type == BOOL) {
+        return in->logic_val;
     }
 
     // otherwise, return a pointer to the gate
-    return g->input[k];
+    return in;
 }
 
 // return one of the gates connected to the output in such a way that
 // if we call the function for all k \in [0, nand_fan_out(g)], each of the gates
 // connected to the output will appear exactly once
 nand_t* nand_output(nand_t const *g, ssize_t k) {
-    return (nand_t*)iterQueue(g->outputs, k);
+    struct nand_input* in = (struct nand_input*)iterQueue(g->outputs, k);
+    return in == NULL ? NULL : in->dst;
 }
\ No newline at end of file
@@ -12,6 +12,8 @@ void    nand_delete(nand_t *g);
 int     nand_connect_nand(nand_t *g_out, nand_t *g_in, unsigned k);
 int     nand_connect_signal(bool const *s, nand_t *g, unsigned k);
 ssize_t nand_evaluate(nand_t **g, bool *s, size_t m);
+ssize_t nand_critical_path(nand_t **g, size_t m, nand_t **path, size_t len);
+ssize_t nand_depth_histogram(nand_t **g, size_t m, size_t *counts, size_t len);
 ssize_t nand_fan_out(nand_t const *g);
 void*   nand_input(nand_t const *g, unsigned k);
 nand_t* nand_output(nand_t const *g, ssize_t k);
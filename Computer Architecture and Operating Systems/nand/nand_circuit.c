@@ -0,0 +1,71 @@
+#include "nand_internal.h"
+
+#include <stdlib.h>
+#include <errno.h>
+
+// size of a single arena chunk - big enough that a large circuit
+// needs only a few thousand calls to malloc
+#define CHUNK_SIZE (1 << 20)
+
+// creating a new, empty circuit
+nand_circuit_t* nand_circuit_new(void) {
+    nand_circuit_t* circuit = (nand_circuit_t*)malloc(sizeof(nand_circuit_t));
+    if (circuit == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    initArena(&circuit->arena, CHUNK_SIZE);
+    initSlab(&circuit->gates, &circuit->arena, sizeof(nand_t));
+    initSlab(&circuit->nodes, &circuit->arena, sizeof(Node));
+    index_pool_init(&circuit->indexes);
+    plan_cache_init(&circuit->cache);
+    circuit->generation = 0;
+    return circuit;
+}
+
+// deleting the circuit frees all of its gates at once,
+// without disconnecting them one by one
+void nand_circuit_delete(nand_circuit_t *c) {
+    if (c == NULL) {
+        return;
+    }
+    plan_cache_free(&c->cache);
+    index_pool_free(&c->indexes);
+    freeArena(&c->arena);
+    free(c);
+}
+
+// creating a new gate in the circuit, works like nand_new
+nand_t* nand_circuit_new_gate(nand_circuit_t *c, unsigned n) {
+    if (c == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+    // the input array and the queue are bump allocated,
+    // the gate itself comes from the slab so that deleted gates are reused
+    nand_t* new_nand = (nand_t*)slabAlloc(&c->gates);
+    if (new_nand == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    new_nand->input = (struct nand_input*)arenaAlloc(&c->arena, n * sizeof(struct nand_input));
+    Queue* queuePtr = (Queue*)arenaAlloc(&c->arena, sizeof(Queue));
+    if (new_nand->input == NULL || queuePtr == NULL ||
+        index_pool_get(&c->indexes, &new_nand->index) == -1) {
+        errno = ENOMEM;
+        slabFree(&c->gates, new_nand);
+        return NULL;
+    }
+    initQueue(queuePtr, &c->nodes);
+
+    for (unsigned idx = 0; idx < n; ++idx) {
+        new_nand->input[idx] = (struct nand_input){NULL, new_nand, NULL, 0};
+    }
+    new_nand->outputs = queuePtr;
+    new_nand->type = NAND;
+    new_nand->input_size = n;
+    new_nand->circuit = c;
+    new_nand->kept = NULL;
+    new_nand->group = NULL;
+    return new_nand;
+}
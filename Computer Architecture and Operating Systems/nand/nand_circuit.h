@@ -0,0 +1,17 @@
+#ifndef NAND_CIRCUIT_H
+#define NAND_CIRCUIT_H
+
+#include "nand.h"
+
+// A circuit is an optional memory context for gates. Gates created in a
+// circuit take all their memory (the gate, its input array, the outputs queue,
+// fan-out edges and connected signals) from the circuit's arena, and the whole
+// circuit is freed at once. They are used with the rest of nand.h as usual,
+// but may only be connected to gates of the same circuit.
+typedef struct nand_circuit nand_circuit_t;
+
+nand_circuit_t* nand_circuit_new(void);
+void            nand_circuit_delete(nand_circuit_t *c);
+nand_t*         nand_circuit_new_gate(nand_circuit_t *c, unsigned n);
+
+#endif
@@ -0,0 +1,278 @@
+#include "nand_fault.h"
+#include "nand_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+// Parallel pattern single fault propagation - 64 vectors are simulated at
+// once, one in every bit of a word. The good values of all the gates are
+// computed once per block of vectors, and then for every fault only the
+// gates whose value changes are evaluated again, in the order of ids
+// (a gate comes after all of its inputs), until the change reaches an output
+// or disappears.
+
+#define BLOCK 64
+
+typedef struct {
+    const Plan *plan;
+
+    // gates reading the output of gate i are
+    // fanout[fanout_offset[i]], ..., fanout[fanout_offset[i + 1] - 1]
+    uint32_t *fanout_offset;
+    gate_id *fanout;
+    bool *is_output;
+
+    uint64_t *signal_words;
+    uint64_t *good;
+    // faulty[i] is valid only if changed[i] == epoch
+    uint64_t *faulty;
+    uint32_t *changed;
+    uint32_t *queued;
+    uint32_t epoch;
+
+    // min-heap of the gates to evaluate again
+    gate_id *heap;
+    size_t heap_size;
+} FaultSim;
+
+static void free_sim(FaultSim *sim) {
+    free(sim->fanout_offset);
+    free(sim->fanout);
+    free(sim->is_output);
+    free(sim->signal_words);
+    free(sim->good);
+    free(sim->faulty);
+    free(sim->changed);
+    free(sim->queued);
+    free(sim->heap);
+}
+
+static int init_sim(FaultSim *sim, const Plan *plan) {
+    size_t size = plan->size;
+    sim->plan = plan;
+    sim->fanout_offset = (uint32_t*)calloc(size + 1, sizeof(uint32_t));
+    sim->fanout = (gate_id*)malloc(max(plan->edge_count, 1) * sizeof(gate_id));
+    sim->is_output = (bool*)calloc(max(size, 1), sizeof(bool));
+    sim->signal_words = (uint64_t*)malloc(max(plan->signal_count, 1) * sizeof(uint64_t));
+    sim->good = (uint64_t*)malloc(max(size, 1) * sizeof(uint64_t));
+    sim->faulty = (uint64_t*)malloc(max(size, 1) * sizeof(uint64_t));
+    sim->changed = (uint32_t*)calloc(max(size, 1), sizeof(uint32_t));
+    sim->queued = (uint32_t*)calloc(max(size, 1), sizeof(uint32_t));
+    sim->heap = (gate_id*)malloc(max(size, 1) * sizeof(gate_id));
+    sim->epoch = 0;
+    sim->heap_size = 0;
+    if (sim->fanout_offset == NULL || sim->fanout == NULL || sim->is_output == NULL ||
+        sim->signal_words == NULL || sim->good == NULL || sim->faulty == NULL ||
+        sim->changed == NULL || sim->queued == NULL || sim->heap == NULL) {
+        free_sim(sim);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // counting sort of the gate edges by their source
+    for (uint32_t e = 0; e < plan->edge_count; ++e) {
+        if (!(plan->edges[e] & SIGNAL_BIT)) {
+            ++sim->fanout_offset[plan->edges[e] + 1];
+        }
+    }
+    for (gate_id i = 0; i < size; ++i) {
+        sim->fanout_offset[i + 1] += sim->fanout_offset[i];
+    }
+    // queued is not used yet, so it holds the next free position of every gate
+    uint32_t *next = sim->queued;
+    memcpy(next, sim->fanout_offset, size * sizeof(uint32_t));
+    for (gate_id i = 0; i < size; ++i) {
+        for (uint32_t e = plan->input_offset[i]; e < plan->input_offset[i + 1]; ++e) {
+            if (!(plan->edges[e] & SIGNAL_BIT)) {
+                sim->fanout[next[plan->edges[e]]++] = i;
+            }
+        }
+    }
+    memset(sim->queued, 0, size * sizeof(uint32_t));
+
+    for (uint32_t idx = 0; idx < plan->output_count; ++idx) {
+        if (!(plan->outputs[idx] & SIGNAL_BIT)) {
+            sim->is_output[plan->outputs[idx]] = true;
+        }
+    }
+    return 0;
+}
+
+static void heap_push(FaultSim *sim, gate_id id) {
+    size_t pos = sim->heap_size++;
+    while (pos > 0 && sim->heap[(pos - 1) / 2] > id) {
+        sim->heap[pos] = sim->heap[(pos - 1) / 2];
+        pos = (pos - 1) / 2;
+    }
+    sim->heap[pos] = id;
+}
+
+static gate_id heap_pop(FaultSim *sim) {
+    gate_id top = sim->heap[0];
+    gate_id last = sim->heap[--sim->heap_size];
+    size_t pos = 0;
+    for (;;) {
+        size_t child = 2 * pos + 1;
+        if (child >= sim->heap_size) {
+            break;
+        }
+        if (child + 1 < sim->heap_size && sim->heap[child + 1] < sim->heap[child]) {
+            ++child;
+        }
+        if (sim->heap[child] >= last) {
+            break;
+        }
+        sim->heap[pos] = sim->heap[child];
+        pos = child;
+    }
+    sim->heap[pos] = last;
+    return top;
+}
+
+// packs vectors first, ..., first + count - 1 into bits of the signal words
+static void load_block(FaultSim *sim, const bool *vectors, size_t first, size_t count) {
+    size_t n = sim->plan->signal_count;
+    memset(sim->signal_words, 0, n * sizeof(uint64_t));
+    for (size_t v = 0; v < count; ++v) {
+        const bool *vector = vectors + (first + v) * n;
+        for (size_t slot = 0; slot < n; ++slot) {
+            sim->signal_words[slot] |= (uint64_t)vector[slot] << v;
+        }
+    }
+}
+
+static void evaluate_good(FaultSim *sim) {
+    const Plan *plan = sim->plan;
+    for (gate_id i = 0; i < plan->size; ++i) {
+        if (plan->kind[i] == KIND_FALSE) {
+            sim->good[i] = 0;
+            continue;
+        }
+        uint64_t all = ~(uint64_t)0;
+        for (uint32_t e = plan->input_offset[i]; e < plan->input_offset[i + 1]; ++e) {
+            uint32_t edge = plan->edges[e];
+            all &= edge & SIGNAL_BIT ? sim->signal_words[edge & ~SIGNAL_BIT] : sim->good[edge];
+        }
+        sim->good[i] = ~all;
+    }
+}
+
+static uint64_t evaluate_faulty(const FaultSim *sim, gate_id i) {
+    const Plan *plan = sim->plan;
+    if (plan->kind[i] == KIND_FALSE) {
+        return 0;
+    }
+    uint64_t all = ~(uint64_t)0;
+    for (uint32_t e = plan->input_offset[i]; e < plan->input_offset[i + 1]; ++e) {
+        uint32_t edge = plan->edges[e];
+        if (edge & SIGNAL_BIT) {
+            all &= sim->signal_words[edge & ~SIGNAL_BIT];
+        }
+        else {
+            all &= sim->changed[edge] == sim->epoch ? sim->faulty[edge] : sim->good[edge];
+        }
+    }
+    return ~all;
+}
+
+static void push_fanout(FaultSim *sim, gate_id i) {
+    for (uint32_t e = sim->fanout_offset[i]; e < sim->fanout_offset[i + 1]; ++e) {
+        gate_id out = sim->fanout[e];
+        if (sim->queued[out] != sim->epoch) {
+            sim->queued[out] = sim->epoch;
+            heap_push(sim, out);
+        }
+    }
+}
+
+// starts a new fault, forgetting the faulty values of the previous one
+static void next_epoch(FaultSim *sim) {
+    if (++sim->epoch == 0) {
+        memset(sim->changed, 0, sim->plan->size * sizeof(uint32_t));
+        memset(sim->queued, 0, sim->plan->size * sizeof(uint32_t));
+        sim->epoch = 1;
+    }
+    sim->heap_size = 0;
+}
+
+// returns true if some of the vectors in mask detect the fault
+static bool simulate_fault(FaultSim *sim, nand_fault_t fault, uint64_t mask) {
+    uint64_t value = fault.value ? ~(uint64_t)0 : 0;
+    if (((value ^ sim->good[fault.gate]) & mask) == 0) {
+        // no vector sets the gate to the other value
+        return false;
+    }
+    if (sim->is_output[fault.gate]) {
+        return true;
+    }
+    next_epoch(sim);
+    sim->faulty[fault.gate] = value;
+    sim->changed[fault.gate] = sim->epoch;
+    push_fanout(sim, fault.gate);
+    while (sim->heap_size > 0) {
+        gate_id i = heap_pop(sim);
+        uint64_t faulty = evaluate_faulty(sim, i);
+        if (((faulty ^ sim->good[i]) & mask) == 0) {
+            continue;
+        }
+        if (sim->is_output[i]) {
+            return true;
+        }
+        sim->faulty[i] = faulty;
+        sim->changed[i] = sim->epoch;
+        push_fanout(sim, i);
+    }
+    return false;
+}
+
+size_t nand_fault_all(nand_netlist_t const *net, nand_fault_t *faults) {
+    if (net == NULL || faults == NULL) {
+        return 0;
+    }
+    for (gate_id i = 0; i < net->plan.size; ++i) {
+        faults[2 * i] = (nand_fault_t){.gate = i, .value = false};
+        faults[2 * i + 1] = (nand_fault_t){.gate = i, .value = true};
+    }
+    return 2 * (size_t)net->plan.size;
+}
+
+ssize_t nand_fault_simulate(nand_netlist_t const *net, nand_fault_t const *faults,
+                            size_t fault_count, bool const *vectors, size_t count,
+                            bool *detected) {
+    if (net == NULL || (fault_count > 0 && (faults == NULL || detected == NULL)) ||
+        (count > 0 && vectors == NULL && net->plan.signal_count > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t f = 0; f < fault_count; ++f) {
+        if (faults[f].gate >= net->plan.size) {
+            errno = EINVAL;
+            return -1;
+        }
+        detected[f] = false;
+    }
+
+    FaultSim sim;
+    if (init_sim(&sim, &net->plan) == -1) {
+        return -1;
+    }
+    size_t remaining = fault_count;
+    for (size_t first = 0; first < count && remaining > 0; first += BLOCK) {
+        size_t block = count - first < BLOCK ? count - first : BLOCK;
+        uint64_t mask = block == BLOCK ? ~(uint64_t)0 : ((uint64_t)1 << block) - 1;
+        load_block(&sim, vectors, first, block);
+        evaluate_good(&sim);
+        // detected faults are dropped from the next blocks
+        for (size_t f = 0; f < fault_count; ++f) {
+            if (!detected[f] && simulate_fault(&sim, faults[f], mask)) {
+                detected[f] = true;
+                --remaining;
+            }
+        }
+    }
+    free_sim(&sim);
+    return fault_count - remaining;
+}
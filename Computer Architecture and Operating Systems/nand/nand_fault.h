@@ -0,0 +1,28 @@
+#ifndef NAND_FAULT_H
+#define NAND_FAULT_H
+
+#include <stdint.h>
+
+#include "nand_netlist.h"
+
+// A single stuck-at fault - the output of the netlist gate `gate`
+// is always `value`.
+typedef struct {
+    uint32_t gate;
+    bool value;
+} nand_fault_t;
+
+// Writes both stuck-at faults of every gate of the netlist to `faults`,
+// which has to have room for 2 * nand_netlist_size(net) of them.
+// Returns the number of faults written.
+size_t  nand_fault_all(nand_netlist_t const *net, nand_fault_t *faults);
+
+// Simulates the faults for `count` vectors of signal values; the value of
+// slot i in vector v is vectors[v * nand_netlist_signal_count(net) + i].
+// Sets detected[f] if some vector gives a different output with the fault
+// f than without it. Returns the number of detected faults.
+ssize_t nand_fault_simulate(nand_netlist_t const *net, nand_fault_t const *faults,
+                            size_t fault_count, bool const *vectors, size_t count,
+                            bool *detected);
+
+#endif
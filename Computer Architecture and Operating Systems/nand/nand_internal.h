@@ -0,0 +1,131 @@
+// Definitions shared by the modules of the library,
+// not a part of the public interface
+
+#ifndef NAND_INTERNAL_H
+#define NAND_INTERNAL_H
+
+#include "nand.h"
+#include "nand_circuit.h"
+#include "nand_netlist.h"
+#include "queue.h"
+#include "arena.h"
+#include "plan.h"
+#include "gate_index.h"
+
+// typ - boolean signal or nand gate
+enum Type {
+    BOOL,
+    NAND
+};
+
+// an input of a gate - what is connected to it (a gate or a signal wrapper)
+// and, for a gate, the node of this connection in that gate's outputs queue
+// the nodes point back at the inputs, so that both ends of a connection
+// can be found and removed in constant time
+// the index of the gate on the other end is kept here too, so that
+// plan_build can tell whether it has seen that gate without reading it
+struct nand_input {
+    nand_t *src;
+    nand_t *dst;
+    Node *edge;
+    uint32_t index;
+};
+
+// index of a signal wrapper
+#define SIGNAL_INDEX UINT32_MAX
+
+// boolean signal treated as a kind of nand
+// therefore, I use a union here
+struct nand {
+    enum Type type;
+    union {
+        struct {
+            struct nand_input *input;
+            unsigned input_size;
+            // dense index of the gate, see gate_index.h
+            uint32_t index;
+
+            // queue of the inputs (struct nand_input) this gate is connected to
+            Queue* outputs;
+
+            // circuit the memory of the gate comes from,
+            // NULL for gates created with nand_new
+            nand_circuit_t *circuit;
+            // plan of the last nand_evaluate with this gate as the first output,
+            // allocated on demand and only for gates created with nand_new
+            struct kept_plan *kept;
+            // group of the gates connected to this one, NULL until
+            // it's needed and for gates of a circuit, see nand_changed
+            struct nand_group *group;
+        };
+        bool* logic_val;
+    };
+};
+
+// circuit context - gates, their input arrays, queues, queue nodes
+// and signal wrappers all live in one arena
+struct nand_circuit {
+    Arena arena;
+    // nand_t objects - both gates and signal wrappers
+    Slab gates;
+    // nodes of the outputs queues
+    Slab nodes;
+    // indexes of the gates
+    IndexPool indexes;
+    // plan of the last nand_evaluate of gates from this circuit
+    // and the generation of its gates, see nand_changed
+    PlanCache cache;
+    unsigned long generation;
+};
+
+// a plan kept with a gate created with nand_new
+struct kept_plan {
+    PlanCache cache;
+    // the plans kept with the gates of a group are on a list
+    bool listed;
+    struct kept_plan *next;
+};
+
+// gates created with nand_new that are connected, directly or not, are in
+// one group - groups are only ever merged (by union by size), so every group
+// has a single root whose generation and plans are the ones of all its gates
+struct nand_group {
+    struct nand_group *parent;
+    unsigned long generation;
+    struct kept_plan *plans;
+    struct kept_plan **plans_end;
+    size_t size;
+    // gates and groups pointing at this one
+    size_t refs;
+};
+
+// every connection, disconnection and deletion of a gate calls nand_changed,
+// so that the kept plans are rebuilt - it gives the gates that could be
+// in the same cones a new generation, higher than any given before:
+// the whole circuit for a gate of a circuit, since its gates can only be
+// connected to each other, and the group of the gate otherwise
+// a plan built after a generation was given stays valid until the next one,
+// and the plans kept with the circuit or with the gates of the group
+// are freed right away, so that their memory doesn't outlive the change
+void nand_changed(nand_t *g);
+// returns the plan for the outputs g, built again only if some gate changed
+// since the last call - it's kept with the circuit of g[0] (or with g[0] itself)
+// or, if the outputs come from different circuits, built into `local`,
+// which the caller frees after using the plan
+// returns NULL (and sets errno like plan_build) on failure
+PlanCache* nand_plan(nand_t **g, size_t m, PlanCache *local);
+
+// netlist - a plan whose signal slots are chosen by the user,
+// either built in memory or mapped from a file
+struct nand_netlist {
+    Plan plan;
+    // the mapped file the arrays of the plan point into,
+    // NULL if they were allocated by plan_build
+    void *map;
+    size_t map_size;
+    // scratch for nand_netlist_evaluate
+    bool *signal_values;
+    bool *values;
+};
+
+#endif //NAND_INTERNAL_H
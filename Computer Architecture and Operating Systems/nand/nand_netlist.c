@@ -0,0 +1,514 @@
+#include "nand_netlist.h"
+#include "nand_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+// the file starts with this header, followed by the arrays of the plan,
+// each of them starting at a multiple of 8 bytes
+// numbers are written in the byte order of the machine that saved the file,
+// and byte_order lets a machine with the other order tell it can't read it
+#define NETLIST_MAGIC "NANDNET1"
+#define NETLIST_BYTE_ORDER 0x01020304u
+#define ALIGN 8
+#define align_up(x) (((x) + ALIGN - 1) / ALIGN * ALIGN)
+
+struct netlist_header {
+    char magic[8];
+    uint32_t size;
+    uint32_t edge_count;
+    uint32_t signal_count;
+    uint32_t output_count;
+    uint32_t level_count;
+    uint32_t byte_order;
+};
+
+// where in the file every array starts
+struct layout {
+    size_t input_offset;
+    size_t critical_length;
+    size_t level_offset;
+    size_t edges;
+    size_t outputs;
+    size_t kind;
+    size_t total;
+};
+
+static void netlist_layout(const struct netlist_header *h, struct layout *l) {
+    l->input_offset = align_up(sizeof(struct netlist_header));
+    l->critical_length = align_up(l->input_offset + ((size_t)h->size + 1) * sizeof(uint32_t));
+    l->level_offset = align_up(l->critical_length + (size_t)h->size * sizeof(uint32_t));
+    l->edges = align_up(l->level_offset + ((size_t)h->level_count + 1) * sizeof(uint32_t));
+    l->outputs = align_up(l->edges + (size_t)h->edge_count * sizeof(uint32_t));
+    l->kind = align_up(l->outputs + (size_t)h->output_count * sizeof(gate_id));
+    l->total = l->kind + (size_t)h->size * sizeof(uint8_t);
+}
+
+// open addressing hash map from signal pointers to their slots
+struct slot_map {
+    bool const **keys;
+    uint32_t *slots;
+    size_t mask;
+};
+
+static size_t hash_pointer(bool const *ptr) {
+    uint64_t x = (uint64_t)(uintptr_t)ptr;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (size_t)x;
+}
+
+static int slot_map_init(struct slot_map *map, bool const **signals, size_t n) {
+    size_t capacity = 16;
+    while (capacity < 2 * n) {
+        capacity *= 2;
+    }
+    map->keys = (bool const**)calloc(capacity, sizeof(bool*));
+    map->slots = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+    if (map->keys == NULL || map->slots == NULL) {
+        free(map->keys);
+        free(map->slots);
+        return -1;
+    }
+    map->mask = capacity - 1;
+    for (size_t slot = 0; slot < n; ++slot) {
+        size_t idx = hash_pointer(signals[slot]) & map->mask;
+        while (map->keys[idx] != NULL && map->keys[idx] != signals[slot]) {
+            idx = (idx + 1) & map->mask;
+        }
+        // if a signal is given twice, the first slot is used
+        if (map->keys[idx] == NULL) {
+            map->keys[idx] = signals[slot];
+            map->slots[idx] = slot;
+        }
+    }
+    return 0;
+}
+
+// returns the slot of the signal, or -1 if it wasn't given
+static int64_t slot_map_find(const struct slot_map *map, bool const *ptr) {
+    size_t idx = hash_pointer(ptr) & map->mask;
+    while (map->keys[idx] != NULL) {
+        if (map->keys[idx] == ptr) {
+            return map->slots[idx];
+        }
+        idx = (idx + 1) & map->mask;
+    }
+    return -1;
+}
+
+static void slot_map_free(struct slot_map *map) {
+    free(map->keys);
+    free(map->slots);
+}
+
+// allocates the scratch arrays of the netlist
+static int netlist_alloc_scratch(nand_netlist_t *net) {
+    net->signal_values = (bool*)malloc(max(net->plan.signal_count, 1) * sizeof(bool));
+    net->values = (bool*)malloc(max(net->plan.size, 1) * sizeof(bool));
+    if (net->signal_values == NULL || net->values == NULL) {
+        free(net->signal_values);
+        free(net->values);
+        return -1;
+    }
+    return 0;
+}
+
+nand_netlist_t* nand_netlist_new(nand_t **g, size_t m, bool const **signals, size_t n) {
+    // we check the validity of the data
+    if (m <= 0 || g == NULL || (signals == NULL && n > 0) || n > MAX_GATES) {
+        errno = EINVAL;
+        return NULL;
+    }
+    for (size_t idx = 0; idx < m; ++idx) {
+        if (g[idx] == NULL) {
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+    for (size_t slot = 0; slot < n; ++slot) {
+        if (signals[slot] == NULL) {
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    nand_netlist_t *net = (nand_netlist_t*)malloc(sizeof(nand_netlist_t));
+    if (net == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (plan_build(&net->plan, g, m) == -1) {
+        free(net);
+        return NULL;
+    }
+    net->map = NULL;
+    net->map_size = 0;
+
+    // the plan gives every connection a slot of its own,
+    // we replace them with the slots chosen by the user
+    struct slot_map map;
+    if (slot_map_init(&map, signals, n) == -1) {
+        errno = ENOMEM;
+        goto fail;
+    }
+    Plan *plan = &net->plan;
+    for (uint32_t e = 0; e < plan->edge_count; ++e) {
+        if (!(plan->edges[e] & SIGNAL_BIT)) {
+            continue;
+        }
+        int64_t slot = slot_map_find(&map, plan->signals[plan->edges[e] & ~SIGNAL_BIT]);
+        if (slot == -1) {
+            slot_map_free(&map);
+            errno = EINVAL;
+            goto fail;
+        }
+        plan->edges[e] = (uint32_t)slot | SIGNAL_BIT;
+    }
+    slot_map_free(&map);
+
+    // plan->signals has room for one slot per edge, which is enough
+    // unless the user gave us more signals than there are connections
+    bool const **slots = (bool const**)realloc(plan->signals, max(n, 1) * sizeof(bool*));
+    if (slots == NULL) {
+        errno = ENOMEM;
+        goto fail;
+    }
+    plan->signals = slots;
+    memcpy(plan->signals, signals, n * sizeof(bool*));
+    plan->signal_count = n;
+
+    if (netlist_alloc_scratch(net) == -1) {
+        errno = ENOMEM;
+        goto fail;
+    }
+    return net;
+
+fail:
+    plan_free(&net->plan);
+    free(net);
+    return NULL;
+}
+
+void nand_netlist_delete(nand_netlist_t *net) {
+    if (net == NULL) {
+        return;
+    }
+    if (net->map != NULL) {
+        munmap(net->map, net->map_size);
+    }
+    else {
+        plan_free(&net->plan);
+    }
+    free(net->signal_values);
+    free(net->values);
+    free(net);
+}
+
+// writes the array and pads it with zeros up to the given file offset
+static int write_array(FILE *file, const void *array, size_t size, size_t *written, size_t end) {
+    static const char zeros[ALIGN] = {0};
+    if (size > 0 && fwrite(array, 1, size, file) != size) {
+        return -1;
+    }
+    *written += size;
+    if (end > *written && fwrite(zeros, 1, end - *written, file) != end - *written) {
+        return -1;
+    }
+    *written = max(*written, end);
+    return 0;
+}
+
+int nand_netlist_save(nand_netlist_t const *net, char const *path) {
+    if (net == NULL || path == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    const Plan *plan = &net->plan;
+    struct netlist_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, NETLIST_MAGIC, sizeof(header.magic));
+    header.size = plan->size;
+    header.edge_count = plan->edge_count;
+    header.signal_count = plan->signal_count;
+    header.output_count = plan->output_count;
+    header.level_count = plan->level_count;
+    header.byte_order = NETLIST_BYTE_ORDER;
+    struct layout layout;
+    netlist_layout(&header, &layout);
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+    size_t written = 0;
+    if (write_array(file, &header, sizeof(header), &written, layout.input_offset) == -1 ||
+        write_array(file, plan->input_offset, ((size_t)plan->size + 1) * sizeof(uint32_t),
+                    &written, layout.critical_length) == -1 ||
+        write_array(file, plan->critical_length, (size_t)plan->size * sizeof(uint32_t),
+                    &written, layout.level_offset) == -1 ||
+        write_array(file, plan->level_offset, ((size_t)plan->level_count + 1) * sizeof(uint32_t),
+                    &written, layout.edges) == -1 ||
+        write_array(file, plan->edges, (size_t)plan->edge_count * sizeof(uint32_t),
+                    &written, layout.outputs) == -1 ||
+        write_array(file, plan->outputs, (size_t)plan->output_count * sizeof(gate_id),
+                    &written, layout.kind) == -1 ||
+        write_array(file, plan->kind, (size_t)plan->size * sizeof(uint8_t),
+                    &written, layout.total) == -1) {
+        int saved = errno;
+        fclose(file);
+        errno = saved;
+        return -1;
+    }
+    if (fclose(file) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int nand_save(nand_t **g, size_t m, bool const **signals, size_t n, char const *path) {
+    nand_netlist_t *net = nand_netlist_new(g, m, signals, n);
+    if (net == NULL) {
+        return -1;
+    }
+    int result = nand_netlist_save(net, path);
+    int saved = errno;
+    nand_netlist_delete(net);
+    errno = saved;
+    return result;
+}
+
+// checks that the arrays of a loaded plan can be evaluated without reading
+// outside of them: the offsets grow and end at the sizes, every gate reads
+// gates of lower levels or existing signal slots, and the outputs exist
+static bool plan_is_valid(const Plan *plan) {
+    if (plan->level_offset[0] != 0 || plan->level_offset[plan->level_count] != plan->size ||
+        plan->input_offset[0] != 0 || plan->input_offset[plan->size] != plan->edge_count) {
+        return false;
+    }
+    for (uint32_t l = 0; l < plan->level_count; ++l) {
+        if (plan->level_offset[l] > plan->level_offset[l + 1]) {
+            return false;
+        }
+    }
+    for (uint32_t l = 0; l < plan->level_count; ++l) {
+        for (gate_id id = plan->level_offset[l]; id < plan->level_offset[l + 1]; ++id) {
+            if (plan->input_offset[id] > plan->input_offset[id + 1] ||
+                plan->critical_length[id] != l ||
+                (plan->kind[id] != KIND_NAND && plan->kind[id] != KIND_FALSE)) {
+                return false;
+            }
+            for (uint32_t e = plan->input_offset[id]; e < plan->input_offset[id + 1]; ++e) {
+                uint32_t edge = plan->edges[e];
+                if (edge & SIGNAL_BIT ? (edge & ~SIGNAL_BIT) >= plan->signal_count
+                                      : edge >= plan->level_offset[l]) {
+                    return false;
+                }
+            }
+        }
+    }
+    for (uint32_t idx = 0; idx < plan->output_count; ++idx) {
+        uint32_t out = plan->outputs[idx];
+        if (out & SIGNAL_BIT ? (out & ~SIGNAL_BIT) >= plan->signal_count : out >= plan->size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// maps the file and points the arrays of the plan into it,
+// nothing is copied, so pages are only read when evaluation needs them
+nand_netlist_t* nand_load(char const *path) {
+    if (path == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return NULL;
+    }
+    size_t file_size = st.st_size;
+    if (file_size < sizeof(struct netlist_header)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    void *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    // first the header has to be ours and the arrays have to fit in the file
+    const struct netlist_header *header = (const struct netlist_header*)map;
+    struct layout layout;
+    netlist_layout(header, &layout);
+    if (memcmp(header->magic, NETLIST_MAGIC, sizeof(header->magic)) != 0 ||
+        header->byte_order != NETLIST_BYTE_ORDER ||
+        header->size > MAX_GATES || header->signal_count > MAX_GATES ||
+        header->output_count == 0 || layout.total != file_size) {
+        munmap(map, file_size);
+        errno = EINVAL;
+        return NULL;
+    }
+    madvise(map, file_size, MADV_SEQUENTIAL);
+
+    nand_netlist_t *net = (nand_netlist_t*)malloc(sizeof(nand_netlist_t));
+    if (net == NULL) {
+        munmap(map, file_size);
+        errno = ENOMEM;
+        return NULL;
+    }
+    char *base = (char*)map;
+    Plan *plan = &net->plan;
+    plan->size = header->size;
+    plan->edge_count = header->edge_count;
+    plan->signal_count = header->signal_count;
+    plan->output_count = header->output_count;
+    plan->level_count = header->level_count;
+    plan->input_offset = (uint32_t*)(base + layout.input_offset);
+    plan->critical_length = (uint32_t*)(base + layout.critical_length);
+    plan->level_offset = (uint32_t*)(base + layout.level_offset);
+    plan->edges = (uint32_t*)(base + layout.edges);
+    plan->outputs = (gate_id*)(base + layout.outputs);
+    plan->kind = (uint8_t*)(base + layout.kind);
+    plan->signals = NULL;
+    plan->gates = NULL;
+    net->map = map;
+    net->map_size = file_size;
+
+    if (!plan_is_valid(plan)) {
+        munmap(map, file_size);
+        free(net);
+        errno = EINVAL;
+        return NULL;
+    }
+    if (netlist_alloc_scratch(net) == -1) {
+        munmap(map, file_size);
+        free(net);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return net;
+}
+
+// evaluates the plan using only the given scratch arrays, so that
+// calls with different scratch arrays can run at the same time
+static ssize_t netlist_evaluate(const Plan *plan, bool const *signals, bool *s,
+                                bool *signal_values, bool *values) {
+    if (signals == NULL) {
+        plan_read_signals(plan, signal_values);
+        signals = signal_values;
+    }
+    plan_evaluate_range(plan, signals, values, 0, plan->size);
+
+    ssize_t max_ = 0;
+    for (uint32_t idx = 0; idx < plan->output_count; ++idx) {
+        s[idx] = plan_output_value(plan, idx, signals, values);
+        max_ = max(max_, (ssize_t)plan_output_length(plan, idx));
+    }
+    return max_;
+}
+
+ssize_t nand_netlist_evaluate(nand_netlist_t *net, bool const *signals, bool *s) {
+    // we check the validity of the data
+    if (net == NULL || s == NULL || (signals == NULL && net->plan.signals == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+    return netlist_evaluate(&net->plan, signals, s, net->signal_values, net->values);
+}
+
+// the critical path lengths are stored in the netlist and never change,
+// so the scratch only holds the values of the gates and the signals
+size_t nand_netlist_scratch_size(nand_netlist_t const *net) {
+    if (net == NULL) {
+        return 0;
+    }
+    return (size_t)net->plan.size * sizeof(bool) + net->plan.signal_count * sizeof(bool);
+}
+
+ssize_t nand_netlist_evaluate_r(nand_netlist_t const *net, bool const *signals, bool *s,
+                                void *scratch) {
+    // we check the validity of the data
+    if (net == NULL || s == NULL || (signals == NULL && net->plan.signals == NULL) ||
+        (scratch == NULL && nand_netlist_scratch_size(net) > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    bool *values = (bool*)scratch;
+    return netlist_evaluate(&net->plan, signals, s, values + net->plan.size, values);
+}
+
+// the critical path lengths are known for every gate, so a longest path
+// is found by following, from the deepest output, an input that is
+// exactly one level lower - there always is one
+ssize_t nand_netlist_critical_path(nand_netlist_t const *net, uint32_t *path, size_t len) {
+    if (net == NULL || (path == NULL && len > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    // if every output is a signal, the path is empty
+    size_t count = 0;
+    for (uint32_t curr = plan_path_start(&net->plan); curr != SIGNAL_BIT;
+         curr = plan_path_next(&net->plan, curr)) {
+        if (count < len) {
+            path[count] = curr;
+        }
+        ++count;
+    }
+    return count;
+}
+
+// gates are numbered by level, so the counts are differences of level offsets
+ssize_t nand_netlist_depth_histogram(nand_netlist_t const *net, size_t *counts, size_t len) {
+    if (net == NULL || (counts == NULL && len > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    const Plan *plan = &net->plan;
+    for (uint32_t l = 0; l < plan->level_count && l < len; ++l) {
+        counts[l] = plan->level_offset[l + 1] - plan->level_offset[l];
+    }
+    return plan->level_count;
+}
+
+nand_t* nand_netlist_gate(nand_netlist_t const *net, uint32_t id) {
+    if (net == NULL || id >= net->plan.size) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (net->plan.gates == NULL) {
+        errno = 0;
+        return NULL;
+    }
+    return net->plan.gates[id];
+}
+
+size_t nand_netlist_size(nand_netlist_t const *net) {
+    return net == NULL ? 0 : net->plan.size;
+}
+
+size_t nand_netlist_signal_count(nand_netlist_t const *net) {
+    return net == NULL ? 0 : net->plan.signal_count;
+}
+
+size_t nand_netlist_output_count(nand_netlist_t const *net) {
+    return net == NULL ? 0 : net->plan.output_count;
+}
@@ -0,0 +1,67 @@
+#ifndef NAND_NETLIST_H
+#define NAND_NETLIST_H
+
+#include <stdint.h>
+
+#include "nand.h"
+
+// A netlist is an immutable, compiled copy of the cones of a set of gates.
+// Its inputs are numbered signal slots instead of pointers, so it can be
+// saved to a file and evaluated straight from the mapped file later.
+typedef struct nand_netlist nand_netlist_t;
+
+// Compiles the cones of g[0], ..., g[m - 1]; slot i is signals[i], and every
+// signal connected in the cones has to be one of signals[0], ..., signals[n - 1].
+nand_netlist_t* nand_netlist_new(nand_t **g, size_t m, bool const **signals, size_t n);
+void            nand_netlist_delete(nand_netlist_t *net);
+
+int             nand_netlist_save(nand_netlist_t const *net, char const *path);
+int             nand_save(nand_t **g, size_t m, bool const **signals, size_t n,
+                          char const *path);
+nand_netlist_t* nand_load(char const *path);
+
+// Evaluates the outputs for the given values of the signal slots
+// (or, for a netlist compiled from gates, the current values of the signals
+// if `signals` is NULL) and returns the critical path length, like nand_evaluate.
+ssize_t         nand_netlist_evaluate(nand_netlist_t *net, bool const *signals, bool *s);
+// The same, but all the state of the call is kept in `scratch`, a buffer of
+// nand_netlist_scratch_size(net) bytes, and the netlist is only read - any
+// number of threads can evaluate one netlist at once, each with its own scratch.
+size_t          nand_netlist_scratch_size(nand_netlist_t const *net);
+ssize_t         nand_netlist_evaluate_r(nand_netlist_t const *net, bool const *signals, bool *s,
+                                        void *scratch);
+
+// Statistics of nand_netlist_optimize.
+struct nand_optimize_stats {
+    size_t gates_before;
+    size_t gates_after;
+    // gates with the same inputs as an earlier gate
+    size_t merged;
+    // gates whose output turned out to be constant
+    size_t constants;
+    // gates removed as a double inversion
+    size_t inversions;
+};
+
+// Returns a new netlist with the same outputs for all signal values, in which
+// gates with the same inputs are merged, constants are propagated and double
+// inversions are removed. Critical path lengths are those of the new netlist.
+nand_netlist_t* nand_netlist_optimize(nand_netlist_t const *net,
+                                      struct nand_optimize_stats *stats);
+
+// Writes the ids of the gates along a longest path ending in an output,
+// starting with the output and going towards the signals, at most len of them.
+// Returns the number of gates on the whole path.
+ssize_t         nand_netlist_critical_path(nand_netlist_t const *net, uint32_t *path, size_t len);
+// Writes the number of gates with critical path length l to counts[l]
+// for l < len. Returns the number of levels (the maximum length + 1).
+ssize_t         nand_netlist_depth_histogram(nand_netlist_t const *net, size_t *counts, size_t len);
+// The gate a netlist gate id was compiled from (NULL for loaded netlists
+// and gates added by nand_netlist_optimize).
+nand_t*         nand_netlist_gate(nand_netlist_t const *net, uint32_t id);
+
+size_t          nand_netlist_size(nand_netlist_t const *net);
+size_t          nand_netlist_signal_count(nand_netlist_t const *net);
+size_t          nand_netlist_output_count(nand_netlist_t const *net);
+
+#endif
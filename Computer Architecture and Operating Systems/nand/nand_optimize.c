@@ -0,0 +1,369 @@
+#include "nand_netlist.h"
+#include "nand_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+// what a gate of the old netlist is replaced with - an edge of the new one
+// (a new gate id or a signal slot with SIGNAL_BIT) or one of the constants
+#define REF_FALSE UINT32_MAX
+#define REF_TRUE (UINT32_MAX - 1)
+#define NONE UINT32_MAX
+
+// the new gates in the order they were created, which is a topological order
+struct builder {
+    uint32_t *input_offset;
+    uint32_t *edges;
+    // the old gate every new gate was made from, NONE for constants
+    gate_id *origin;
+    gate_id size;
+    uint32_t edge_count;
+
+    // hash table of new gate ids, keyed by their sorted inputs
+    gate_id *table;
+    size_t mask;
+
+    gate_id false_gate;
+    gate_id true_gate;
+};
+
+static int compare_edges(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static size_t hash_inputs(const uint32_t *inputs, uint32_t count) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ count;
+    for (uint32_t idx = 0; idx < count; ++idx) {
+        h ^= inputs[idx];
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    return (size_t)h;
+}
+
+static uint32_t input_count(const struct builder *b, gate_id g) {
+    return b->input_offset[g + 1] - b->input_offset[g];
+}
+
+// the input of a new gate if it's an inverter (a gate with one input),
+// NONE otherwise
+static uint32_t inverted(const struct builder *b, uint32_t edge) {
+    if (edge & SIGNAL_BIT || input_count(b, edge) != 1) {
+        return NONE;
+    }
+    return b->edges[b->input_offset[edge]];
+}
+
+// adds a gate whose inputs are already written at the end of b->edges
+static gate_id add_gate(struct builder *b, uint32_t count, gate_id origin) {
+    gate_id g = b->size++;
+    b->input_offset[g] = b->edge_count;
+    b->edge_count += count;
+    b->input_offset[g + 1] = b->edge_count;
+    b->origin[g] = origin;
+    return g;
+}
+
+// finds a gate with the same inputs as the ones written at the end
+// of b->edges, or adds one
+static gate_id find_or_add(struct builder *b, uint32_t count, gate_id origin, bool *merged) {
+    const uint32_t *inputs = b->edges + b->edge_count;
+    size_t idx = hash_inputs(inputs, count) & b->mask;
+    while (b->table[idx] != NONE) {
+        gate_id g = b->table[idx];
+        if (input_count(b, g) == count &&
+            memcmp(b->edges + b->input_offset[g], inputs, count * sizeof(uint32_t)) == 0) {
+            *merged = true;
+            return g;
+        }
+        idx = (idx + 1) & b->mask;
+    }
+    *merged = false;
+    gate_id g = add_gate(b, count, origin);
+    b->table[idx] = g;
+    return g;
+}
+
+// turns a constant into an edge, so that it can be an output
+static uint32_t materialize(struct builder *b, uint32_t ref) {
+    if (ref != REF_FALSE && ref != REF_TRUE) {
+        return ref;
+    }
+    if (b->false_gate == NONE) {
+        b->false_gate = add_gate(b, 0, NONE);
+    }
+    if (ref == REF_FALSE) {
+        return b->false_gate;
+    }
+    if (b->true_gate == NONE) {
+        b->edges[b->edge_count] = b->false_gate;
+        b->true_gate = add_gate(b, 1, NONE);
+    }
+    return b->true_gate;
+}
+
+// the simplified replacement of the old gate, whose inputs
+// have already been replaced
+static uint32_t simplify(struct builder *b, const Plan *old, const uint32_t *repl,
+                         gate_id id, struct nand_optimize_stats *stats) {
+    uint32_t *inputs = b->edges + b->edge_count;
+    uint32_t count = 0;
+    uint32_t old_count = old->input_offset[id + 1] - old->input_offset[id];
+
+    // a false input makes the output true, true inputs don't matter
+    for (uint32_t e = old->input_offset[id]; e < old->input_offset[id + 1]; ++e) {
+        uint32_t ref = old->edges[e] & SIGNAL_BIT ? old->edges[e] : repl[old->edges[e]];
+        if (ref == REF_FALSE) {
+            ++stats->constants;
+            return REF_TRUE;
+        }
+        if (ref != REF_TRUE) {
+            inputs[count++] = ref;
+        }
+    }
+
+    // repeated inputs don't change the output either
+    qsort(inputs, count, sizeof(uint32_t), compare_edges);
+    uint32_t unique = 0;
+    for (uint32_t idx = 0; idx < count; ++idx) {
+        if (unique == 0 || inputs[unique - 1] != inputs[idx]) {
+            inputs[unique++] = inputs[idx];
+        }
+    }
+    count = unique;
+
+    // no inputs left (or none to begin with) - the constant false
+    if (count == 0) {
+        if (old_count > 0) {
+            ++stats->constants;
+        }
+        return REF_FALSE;
+    }
+
+    // x and not x among the inputs - the output is true
+    for (uint32_t idx = 0; idx < count; ++idx) {
+        uint32_t x = inverted(b, inputs[idx]);
+        if (x != NONE && bsearch(&x, inputs, count, sizeof(uint32_t), compare_edges) != NULL) {
+            ++stats->constants;
+            return REF_TRUE;
+        }
+    }
+
+    // not (not x) is x
+    if (count == 1 && inverted(b, inputs[0]) != NONE) {
+        ++stats->inversions;
+        return inverted(b, inputs[0]);
+    }
+
+    bool merged;
+    gate_id g = find_or_add(b, count, id, &merged);
+    if (merged) {
+        ++stats->merged;
+    }
+    return g;
+}
+
+// copies the gates of the builder that the outputs depend on into a plan,
+// numbering them by level as plan_build does
+static int builder_to_plan(struct builder *b, const Plan *old, const uint32_t *outputs, Plan *plan) {
+    bool *live = (bool*)calloc(max(b->size, 1), sizeof(bool));
+    uint32_t *length = (uint32_t*)malloc(max(b->size, 1) * sizeof(uint32_t));
+    gate_id *new_id = (gate_id*)malloc(max(b->size, 1) * sizeof(gate_id));
+    if (live == NULL || length == NULL || new_id == NULL) {
+        free(live);
+        free(length);
+        free(new_id);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // every gate comes after its inputs, so one backward pass finds all
+    // the live gates and one forward pass their critical path lengths
+    for (uint32_t idx = 0; idx < old->output_count; ++idx) {
+        if (!(outputs[idx] & SIGNAL_BIT)) {
+            live[outputs[idx]] = true;
+        }
+    }
+    plan->size = 0;
+    plan->edge_count = 0;
+    for (gate_id g = b->size; g-- > 0;) {
+        if (!live[g]) {
+            continue;
+        }
+        ++plan->size;
+        plan->edge_count += input_count(b, g);
+        for (uint32_t e = b->input_offset[g]; e < b->input_offset[g + 1]; ++e) {
+            if (!(b->edges[e] & SIGNAL_BIT)) {
+                live[b->edges[e]] = true;
+            }
+        }
+    }
+    uint32_t max_level = 0;
+    for (gate_id g = 0; g < b->size; ++g) {
+        if (!live[g]) {
+            continue;
+        }
+        uint32_t l = 0;
+        for (uint32_t e = b->input_offset[g]; e < b->input_offset[g + 1]; ++e) {
+            uint32_t edge = b->edges[e];
+            l = max(l, edge & SIGNAL_BIT ? 1 : length[edge] + 1);
+        }
+        length[g] = l;
+        max_level = max(max_level, l);
+    }
+
+    plan->signal_count = old->signal_count;
+    plan->output_count = old->output_count;
+    plan->level_count = max_level + 1;
+    if (plan_alloc(plan) == -1) {
+        free(live);
+        free(length);
+        free(new_id);
+        return -1;
+    }
+
+    for (gate_id g = 0; g < b->size; ++g) {
+        if (live[g]) {
+            ++plan->level_offset[length[g] + 1];
+        }
+    }
+    for (uint32_t l = 0; l < plan->level_count; ++l) {
+        plan->level_offset[l + 1] += plan->level_offset[l];
+    }
+    for (gate_id g = 0; g < b->size; ++g) {
+        if (live[g]) {
+            new_id[g] = plan->level_offset[length[g]]++;
+        }
+    }
+    for (uint32_t l = plan->level_count; l > 0; --l) {
+        plan->level_offset[l] = plan->level_offset[l - 1];
+    }
+    plan->level_offset[0] = 0;
+
+    // the gates in the order of their new ids
+    gate_id *order = b->table;
+    for (gate_id g = 0; g < b->size; ++g) {
+        if (live[g]) {
+            order[new_id[g]] = g;
+        }
+    }
+    uint32_t edge = 0;
+    for (gate_id id = 0; id < plan->size; ++id) {
+        gate_id g = order[id];
+        plan->kind[id] = input_count(b, g) == 0 ? KIND_FALSE : KIND_NAND;
+        plan->critical_length[id] = length[g];
+        plan->gates[id] = b->origin[g] == NONE || old->gates == NULL ?
+                          NULL : old->gates[b->origin[g]];
+        plan->input_offset[id] = edge;
+        for (uint32_t e = b->input_offset[g]; e < b->input_offset[g + 1]; ++e) {
+            uint32_t in = b->edges[e];
+            plan->edges[edge++] = in & SIGNAL_BIT ? in : new_id[in];
+        }
+    }
+    plan->input_offset[plan->size] = edge;
+    for (uint32_t idx = 0; idx < old->output_count; ++idx) {
+        plan->outputs[idx] = outputs[idx] & SIGNAL_BIT ? outputs[idx] : new_id[outputs[idx]];
+    }
+    if (old->signals != NULL) {
+        memcpy(plan->signals, old->signals, old->signal_count * sizeof(bool*));
+    }
+    else {
+        free(plan->signals);
+        plan->signals = NULL;
+    }
+
+    free(live);
+    free(length);
+    free(new_id);
+    return 0;
+}
+
+nand_netlist_t* nand_netlist_optimize(nand_netlist_t const *net, struct nand_optimize_stats *stats) {
+    if (net == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+    const Plan *old = &net->plan;
+    struct nand_optimize_stats local;
+    if (stats == NULL) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(*stats));
+    stats->gates_before = old->size;
+
+    // at most every old gate and the two constants, and no more edges
+    // than before plus the one of the constant true
+    size_t capacity = (size_t)old->size + 2;
+    size_t table_size = 16;
+    while (table_size < 2 * capacity) {
+        table_size *= 2;
+    }
+    struct builder b;
+    b.input_offset = (uint32_t*)malloc((capacity + 1) * sizeof(uint32_t));
+    b.edges = (uint32_t*)malloc(((size_t)old->edge_count + 1) * sizeof(uint32_t));
+    b.origin = (gate_id*)malloc(capacity * sizeof(gate_id));
+    b.table = (gate_id*)malloc(table_size * sizeof(gate_id));
+    b.mask = table_size - 1;
+    b.size = 0;
+    b.edge_count = 0;
+    b.false_gate = NONE;
+    b.true_gate = NONE;
+    uint32_t *repl = (uint32_t*)malloc(max(old->size, 1) * sizeof(uint32_t));
+    uint32_t *outputs = (uint32_t*)malloc(max(old->output_count, 1) * sizeof(uint32_t));
+    nand_netlist_t *result = (nand_netlist_t*)malloc(sizeof(nand_netlist_t));
+    if (b.input_offset == NULL || b.edges == NULL || b.origin == NULL || b.table == NULL ||
+        repl == NULL || outputs == NULL || result == NULL) {
+        errno = ENOMEM;
+        goto fail;
+    }
+    memset(b.table, 0xff, table_size * sizeof(gate_id));
+    b.input_offset[0] = 0;
+
+    // ids of the old netlist are in topological order,
+    // so the inputs of every gate are simplified before the gate itself
+    for (gate_id id = 0; id < old->size; ++id) {
+        repl[id] = simplify(&b, old, repl, id, stats);
+    }
+    for (uint32_t idx = 0; idx < old->output_count; ++idx) {
+        uint32_t out = old->outputs[idx];
+        outputs[idx] = materialize(&b, out & SIGNAL_BIT ? out : repl[out]);
+    }
+
+    if (builder_to_plan(&b, old, outputs, &result->plan) == -1) {
+        goto fail;
+    }
+    result->map = NULL;
+    result->map_size = 0;
+    result->signal_values = (bool*)malloc(max(result->plan.signal_count, 1) * sizeof(bool));
+    result->values = (bool*)malloc(max(result->plan.size, 1) * sizeof(bool));
+    if (result->signal_values == NULL || result->values == NULL) {
+        free(result->signal_values);
+        free(result->values);
+        plan_free(&result->plan);
+        errno = ENOMEM;
+        goto fail;
+    }
+    stats->gates_after = result->plan.size;
+
+    free(b.input_offset);
+    free(b.edges);
+    free(b.origin);
+    free(b.table);
+    free(repl);
+    free(outputs);
+    return result;
+
+fail:
+    free(b.input_offset);
+    free(b.edges);
+    free(b.origin);
+    free(b.table);
+    free(repl);
+    free(outputs);
+    free(result);
+    return NULL;
+}
@@ -0,0 +1,275 @@
+#include "nand_parallel.h"
+#include "nand_internal.h"
+#include "plan.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// levels with fewer gates than this aren't worth splitting between threads
+#define WIDE_LEVEL 4096
+// number of gates a thread claims at once
+#define CHUNK 256
+
+// most threads a call can use
+#define MAX_THREADS 256
+
+// a part of the work between two barriers - either a single wide level
+// split between all threads, or a run of narrow levels done by one thread
+struct step {
+    uint32_t first_level;
+    uint32_t last_level;
+    bool wide;
+};
+
+// the part of a wide level assigned to one thread; the other threads steal
+// chunks from it once they are done with their own parts
+struct slice {
+    atomic_size_t next;
+    size_t end;
+    char padding[64 - sizeof(atomic_size_t) - sizeof(size_t)];
+};
+
+struct worker {
+    unsigned id;
+    // the last job this worker has seen
+    unsigned long seen;
+};
+
+// the workers are created on first use and stay, waiting for the next job,
+// so a call only wakes them up - one call uses them at a time
+static struct {
+    pthread_mutex_t call_mutex;
+
+    pthread_mutex_t mutex;
+    // signalled when a job is started and when the workers should stop
+    pthread_cond_t wake;
+    // signalled when a worker is done with a job
+    pthread_cond_t done;
+    unsigned long job;
+    unsigned finished;
+    bool stopping;
+    // workers 1, ..., created - 1 are running, 0 is the calling thread
+    unsigned created;
+    pthread_t ids[MAX_THREADS];
+    struct worker workers[MAX_THREADS];
+
+    // the current job
+    const Plan *plan;
+    const bool *signal_values;
+    bool *values;
+    unsigned threads;
+    pthread_barrier_t barrier;
+    // slices[2 * t + parity] - two sets of slices, so that the slices for
+    // the next step can be set up while others still steal from the current
+    struct slice slices[2 * MAX_THREADS];
+} pool = {
+    .call_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+    .created = 1,
+};
+
+// the step starting at the given level - every wide level is a step of its own,
+// consecutive narrow levels are merged; past the last level the step is empty
+// every thread finds the same steps, so they don't have to be stored
+static struct step step_at(const Plan *plan, uint32_t level) {
+    struct step step = {level, level, false};
+    if (level >= plan->level_count) {
+        return step;
+    }
+    step.wide = plan->level_offset[level + 1] - plan->level_offset[level] >= WIDE_LEVEL;
+    if (!step.wide) {
+        while (step.last_level + 1 < plan->level_count &&
+               plan->level_offset[step.last_level + 2] -
+               plan->level_offset[step.last_level + 1] < WIDE_LEVEL) {
+            ++step.last_level;
+        }
+    }
+    return step;
+}
+
+// assigns the thread its part of the step's level
+static void prepare_step(const struct worker *w, const struct step *step, size_t st) {
+    if (step->first_level >= pool.plan->level_count || !step->wide) {
+        return;
+    }
+    size_t begin = pool.plan->level_offset[step->first_level];
+    size_t length = pool.plan->level_offset[step->first_level + 1] - begin;
+    struct slice *slice = &pool.slices[2 * w->id + st % 2];
+    slice->end = begin + length * (w->id + 1) / pool.threads;
+    atomic_store_explicit(&slice->next, begin + length * w->id / pool.threads,
+                          memory_order_relaxed);
+}
+
+static void run_step(const struct worker *w, const struct step *step, size_t st) {
+    const Plan *plan = pool.plan;
+
+    if (!step->wide) {
+        if (w->id == 0) {
+            plan_evaluate_range(plan, pool.signal_values, pool.values,
+                                plan->level_offset[step->first_level],
+                                plan->level_offset[step->last_level + 1]);
+        }
+        return;
+    }
+
+    // first our own slice, then the slices of the others
+    for (unsigned k = 0; k < pool.threads; ++k) {
+        struct slice *slice = &pool.slices[2 * ((w->id + k) % pool.threads) + st % 2];
+        while (true) {
+            size_t begin = atomic_fetch_add_explicit(&slice->next, CHUNK,
+                                                     memory_order_relaxed);
+            if (begin >= slice->end) {
+                break;
+            }
+            size_t end = min(begin + CHUNK, slice->end);
+            plan_evaluate_range(plan, pool.signal_values, pool.values, begin, end);
+        }
+    }
+}
+
+// the part of the current job done by one thread
+static void run_job(const struct worker *w) {
+    struct step step = step_at(pool.plan, 0);
+    prepare_step(w, &step, 0);
+    pthread_barrier_wait(&pool.barrier);
+    for (size_t st = 0; step.first_level < pool.plan->level_count; ++st) {
+        run_step(w, &step, st);
+        struct step next = step_at(pool.plan, step.last_level + 1);
+        prepare_step(w, &next, st + 1);
+        pthread_barrier_wait(&pool.barrier);
+        step = next;
+    }
+}
+
+static void* worker_main(void *arg) {
+    struct worker *w = (struct worker*)arg;
+    pthread_mutex_lock(&pool.mutex);
+    while (true) {
+        while (!pool.stopping && pool.job == w->seen) {
+            pthread_cond_wait(&pool.wake, &pool.mutex);
+        }
+        if (pool.stopping) {
+            break;
+        }
+        w->seen = pool.job;
+        // a job for fewer threads doesn't need this one
+        if (w->id >= pool.threads) {
+            continue;
+        }
+        pthread_mutex_unlock(&pool.mutex);
+        run_job(w);
+        pthread_mutex_lock(&pool.mutex);
+        ++pool.finished;
+        pthread_cond_signal(&pool.done);
+    }
+    pthread_mutex_unlock(&pool.mutex);
+    return NULL;
+}
+
+// the workers are stopped when the library is unloaded or the program exits
+__attribute__((destructor)) static void stop_workers(void) {
+    pthread_mutex_lock(&pool.call_mutex);
+    pthread_mutex_lock(&pool.mutex);
+    pool.stopping = true;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.mutex);
+    for (unsigned t = 1; t < pool.created; ++t) {
+        pthread_join(pool.ids[t], NULL);
+    }
+    pool.created = 1;
+    pthread_mutex_unlock(&pool.call_mutex);
+}
+
+// evaluates the levels of the plan with the given number of threads,
+// creating the workers that are missing
+static void evaluate_levels(const Plan *plan, const bool *signal_values,
+                            bool *values, unsigned threads) {
+    pthread_mutex_lock(&pool.call_mutex);
+    // if some threads can't be created, we go on with fewer
+    while (pool.created < threads) {
+        struct worker *w = &pool.workers[pool.created];
+        *w = (struct worker){pool.created, pool.job};
+        if (pthread_create(&pool.ids[pool.created], NULL, worker_main, w) != 0) {
+            break;
+        }
+        ++pool.created;
+    }
+    threads = min(threads, pool.created);
+
+    pool.plan = plan;
+    pool.signal_values = signal_values;
+    pool.values = values;
+    pool.threads = threads;
+    pthread_barrier_init(&pool.barrier, NULL, threads);
+
+    pthread_mutex_lock(&pool.mutex);
+    pool.finished = 0;
+    ++pool.job;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.mutex);
+
+    struct worker caller = {0, 0};
+    run_job(&caller);
+
+    // the barrier can go only once every worker has left it
+    pthread_mutex_lock(&pool.mutex);
+    while (pool.finished < threads - 1) {
+        pthread_cond_wait(&pool.done, &pool.mutex);
+    }
+    pthread_mutex_unlock(&pool.mutex);
+    pthread_barrier_destroy(&pool.barrier);
+    pthread_mutex_unlock(&pool.call_mutex);
+}
+
+ssize_t nand_evaluate_parallel(nand_t **g, bool *s, size_t m, unsigned threads) {
+    // we check the validity of the data
+    if (m <= 0 || g == NULL || s == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t idx = 0; idx < m; ++idx) {
+        if (g[idx] == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    if (threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (unsigned)online : 1;
+    }
+    threads = min(threads, MAX_THREADS);
+
+    // the same kept plan as nand_evaluate's
+    PlanCache local;
+    plan_cache_init(&local);
+    PlanCache *cache = nand_plan(g, m, &local);
+    if (cache == NULL) {
+        return -1;
+    }
+    const Plan *plan = &cache->plan;
+    plan_read_signals(plan, cache->signal_values);
+
+    // with no wide level the threads would only wait for each other
+    if (threads == 1 || plan->size < WIDE_LEVEL) {
+        plan_evaluate_range(plan, cache->signal_values, cache->values, 0, plan->size);
+    }
+    else {
+        evaluate_levels(plan, cache->signal_values, cache->values, threads);
+    }
+
+    ssize_t result = 0;
+    for (size_t idx = 0; idx < m; ++idx) {
+        s[idx] = cache->values[plan->outputs[idx]];
+        result = max(result, (ssize_t)plan->critical_length[plan->outputs[idx]]);
+    }
+    plan_cache_free(&local);
+    return result;
+}
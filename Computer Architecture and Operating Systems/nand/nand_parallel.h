@@ -0,0 +1,11 @@
+#ifndef NAND_PARALLEL_H
+#define NAND_PARALLEL_H
+
+#include "nand.h"
+
+// Works like nand_evaluate, but evaluates the gates level by level
+// (a gate's level is its critical path length) using up to `threads`
+// threads; 0 means one thread per online processor.
+ssize_t nand_evaluate_parallel(nand_t **g, bool *s, size_t m, unsigned threads);
+
+#endif
@@ -0,0 +1,439 @@
+#include "plan.h"
+#include "nand_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+// a gate found by the search in plan_build, in the order of finding
+struct visit {
+    nand_t *g;
+    // where its inputs start in the edges of the search
+    uint32_t base;
+    // the critical path length, set once all inputs are done
+    uint32_t length;
+    gate_id id;
+};
+
+// length of a gate whose inputs are still being searched
+#define SEARCHING UINT32_MAX
+
+// the marks of the search are kept in an array indexed by the dense indexes
+// of the gates (see gate_index.h), so that building a plan doesn't write
+// to the gates - a mark counts only if its stamp is the one of the current
+// search, so that the array doesn't have to be cleared between searches
+// the length is kept here too, so that an input found earlier
+// is handled with a single read
+struct mark {
+    uint32_t stamp;
+    uint32_t visit;
+    uint32_t length;
+};
+
+// the marks are per thread, so that cones of gates not connected
+// to each other can be planned at the same time
+struct marks {
+    struct mark *marks;
+    size_t capacity;
+    uint32_t stamp;
+};
+
+static _Thread_local struct marks thread_marks;
+static pthread_key_t marks_key;
+static pthread_once_t marks_once = PTHREAD_ONCE_INIT;
+
+static void free_marks(void *marks) {
+    free(((struct marks*)marks)->marks);
+}
+
+static void create_marks_key(void) {
+    pthread_key_create(&marks_key, free_marks);
+}
+
+// a frame of the depth-first search
+struct frame {
+    nand_t *g;
+    struct mark *mark;
+    uint32_t visit;
+    unsigned next;
+    uint32_t length;
+};
+
+struct search {
+    struct mark *marks;
+    uint32_t stamp;
+    struct visit *visits;
+    size_t visit_count, visit_capacity;
+    struct frame *stack;
+    size_t stack_size, stack_capacity;
+    // the inputs of every visit - visit indexes, or signal slots with SIGNAL_BIT set
+    uint32_t *edges;
+    size_t edge_count, edge_capacity;
+    // every connected signal gets a slot of its own
+    bool const **signals;
+    size_t signal_count, signal_capacity;
+    uint32_t max_level;
+};
+
+// grows a dynamic array so that it can hold `needed` elements
+// returns -1 if allocation failed and 0 otherwise
+static int reserve(void **array, size_t *capacity, size_t needed, size_t elem) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+    size_t new_capacity = *capacity == 0 ? 1024 : 2 * *capacity;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    void *tmp = realloc(*array, new_capacity * elem);
+    if (tmp == NULL) {
+        return -1;
+    }
+    *array = tmp;
+    *capacity = new_capacity;
+    return 0;
+}
+
+// takes the marks of this thread for a new search, with room
+// for every gate index handed out so far
+// returns -1 if allocation failed and 0 otherwise
+static int start_search(struct search *s) {
+    struct marks *marks = &thread_marks;
+    size_t bound = index_bound();
+    if (bound > marks->capacity) {
+        pthread_once(&marks_once, create_marks_key);
+        struct mark *tmp = (struct mark*)realloc(marks->marks, bound * sizeof(struct mark));
+        if (tmp == NULL) {
+            return -1;
+        }
+        memset(tmp + marks->capacity, 0, (bound - marks->capacity) * sizeof(struct mark));
+        marks->marks = tmp;
+        marks->capacity = bound;
+        pthread_setspecific(marks_key, marks);
+    }
+    // once the stamps wrap around the old marks would count again
+    if (++marks->stamp == 0) {
+        memset(marks->marks, 0, marks->capacity * sizeof(struct mark));
+        marks->stamp = 1;
+    }
+    s->marks = marks->marks;
+    s->stamp = marks->stamp;
+    return 0;
+}
+
+static void search_free(struct search *s) {
+    free(s->visits);
+    free(s->stack);
+    free(s->edges);
+    free(s->signals);
+}
+
+// the mark of the gate with the given index, or NULL if it hasn't been found yet
+static inline struct mark* find_mark(const struct search *s, uint32_t index) {
+    struct mark *mark = &s->marks[index];
+    return mark->stamp == s->stamp ? mark : NULL;
+}
+
+// adds the gate to the visits and to the top of the stack
+// returns -1 (and sets errno) if allocation failed
+static int start_visit(struct search *s, nand_t *g) {
+    if (s->visit_count >= MAX_GATES || s->edge_count + g->input_size > UINT32_MAX ||
+        reserve((void**)&s->visits, &s->visit_capacity, s->visit_count + 1,
+                sizeof(struct visit)) == -1 ||
+        reserve((void**)&s->stack, &s->stack_capacity, s->stack_size + 1,
+                sizeof(struct frame)) == -1 ||
+        reserve((void**)&s->edges, &s->edge_capacity, s->edge_count + g->input_size,
+                sizeof(uint32_t)) == -1) {
+        errno = ENOMEM;
+        return -1;
+    }
+    // the inputs are checked one after another, so their marks and the gates
+    // themselves (followed by their input arrays, see nand_new) are fetched
+    // together while the first one waits
+    for (unsigned k = 0; k < g->input_size; ++k) {
+        if (g->input[k].src != NULL && g->input[k].index != SIGNAL_INDEX) {
+            __builtin_prefetch(&s->marks[g->input[k].index]);
+            __builtin_prefetch(g->input[k].src);
+            __builtin_prefetch(g->input[k].src + 1);
+        }
+    }
+    struct mark *mark = &s->marks[g->index];
+    *mark = (struct mark){s->stamp, (uint32_t)s->visit_count, SEARCHING};
+    s->visits[s->visit_count] = (struct visit){g, (uint32_t)s->edge_count, 0, 0};
+    s->stack[s->stack_size++] = (struct frame){g, mark, (uint32_t)s->visit_count++, 0, 0};
+    s->edge_count += g->input_size;
+    return 0;
+}
+
+// we find all gates in the cones of g with an iterative depth-first search
+// (so that deep circuits don't overflow the stack), writing down their
+// inputs and calculating their critical path lengths on the way out
+// returns -1 (and sets errno) on a cycle, a missing input or allocation failure
+static int search_cones(struct search *s, nand_t **g, size_t m) {
+    for (size_t root = 0; root < m; ++root) {
+        // a gate found earlier is done, since the stack is empty
+        if (find_mark(s, g[root]->index) != NULL) {
+            continue;
+        }
+        if (start_visit(s, g[root]) == -1) {
+            return -1;
+        }
+
+        while (s->stack_size > 0) {
+            struct frame *top = &s->stack[s->stack_size - 1];
+
+            // all inputs are done, so the critical path length is known
+            if (top->next == top->g->input_size) {
+                s->visits[top->visit].length = top->length;
+                top->mark->length = top->length;
+                s->max_level = max(s->max_level, top->length);
+                --s->stack_size;
+                if (s->stack_size > 0) {
+                    struct frame *parent = &s->stack[s->stack_size - 1];
+                    parent->length = max(parent->length, top->length + 1);
+                }
+                continue;
+            }
+
+            unsigned k = top->next++;
+            size_t edge = s->visits[top->visit].base + k;
+            const struct nand_input *input = &top->g->input[k];
+            // same as in nand_evaluate - a missing input or a cycle
+            // means we can't calculate
+            if (input->src == NULL) {
+                errno = ECANCELED;
+                return -1;
+            }
+            if (input->index == SIGNAL_INDEX) {
+                if (s->signal_count >= MAX_GATES ||
+                    reserve((void**)&s->signals, &s->signal_capacity, s->signal_count + 1,
+                            sizeof(bool*)) == -1) {
+                    errno = ENOMEM;
+                    return -1;
+                }
+                s->signals[s->signal_count] = input->src->logic_val;
+                s->edges[edge] = (uint32_t)s->signal_count++ | SIGNAL_BIT;
+                top->length = max(top->length, 1);
+                continue;
+            }
+            // the gate itself is read only when it's seen for the first time
+            struct mark *found = find_mark(s, input->index);
+            if (found != NULL) {
+                if (found->length == SEARCHING) {
+                    errno = ECANCELED;
+                    return -1;
+                }
+                s->edges[edge] = found->visit;
+                top->length = max(top->length, found->length + 1);
+                continue;
+            }
+            // start_visit moves the arrays, so top isn't used after it
+            s->edges[edge] = (uint32_t)s->visit_count;
+            if (start_visit(s, input->src) == -1) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// allocates the arrays for the sizes set in the plan
+// (there can be at most one signal slot per edge)
+int plan_alloc(Plan *plan) {
+    plan->kind = (uint8_t*)malloc(max(plan->size, 1) * sizeof(uint8_t));
+    plan->input_offset = (uint32_t*)malloc((plan->size + 1) * sizeof(uint32_t));
+    plan->critical_length = (uint32_t*)malloc(max(plan->size, 1) * sizeof(uint32_t));
+    plan->level_offset = (uint32_t*)calloc(plan->level_count + 1, sizeof(uint32_t));
+    plan->edges = (uint32_t*)malloc(max(plan->edge_count, 1) * sizeof(uint32_t));
+    plan->outputs = (gate_id*)malloc(max(plan->output_count, 1) * sizeof(gate_id));
+    plan->signals = (bool const**)malloc(max(max(plan->edge_count, plan->signal_count), 1) *
+                                         sizeof(bool*));
+    plan->gates = (nand_t**)malloc(max(plan->size, 1) * sizeof(nand_t*));
+    if (plan->kind == NULL || plan->input_offset == NULL || plan->critical_length == NULL ||
+        plan->level_offset == NULL || plan->edges == NULL || plan->outputs == NULL ||
+        plan->signals == NULL || plan->gates == NULL) {
+        plan_free(plan);
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+int plan_build(Plan *plan, nand_t **g, size_t m) {
+    struct search s;
+    memset(&s, 0, sizeof(s));
+    if (start_search(&s) == -1) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (search_cones(&s, g, m) == -1) {
+        search_free(&s);
+        return -1;
+    }
+
+    plan->size = s.visit_count;
+    plan->edge_count = s.edge_count;
+    plan->signal_count = s.signal_count;
+    plan->output_count = m;
+    plan->level_count = s.max_level + 1;
+    if (plan_alloc(plan) == -1) {
+        search_free(&s);
+        return -1;
+    }
+
+    // counting sort of the gates by level gives them their ids - the inputs
+    // of a visit end where the ones of the next visit start, so the gates
+    // themselves aren't read again
+    for (size_t v = 0; v < s.visit_count; ++v) {
+        ++plan->level_offset[s.visits[v].length + 1];
+    }
+    for (uint32_t l = 0; l < plan->level_count; ++l) {
+        plan->level_offset[l + 1] += plan->level_offset[l];
+    }
+    for (size_t v = 0; v < s.visit_count; ++v) {
+        struct visit *curr = &s.visits[v];
+        uint32_t end = v + 1 < s.visit_count ? s.visits[v + 1].base : plan->edge_count;
+        curr->id = plan->level_offset[curr->length]++;
+        plan->gates[curr->id] = curr->g;
+        plan->critical_length[curr->id] = curr->length;
+        plan->kind[curr->id] = end == curr->base ? KIND_FALSE : KIND_NAND;
+        plan->input_offset[curr->id + 1] = end - curr->base;
+    }
+    // the loop above moved every offset one level forward
+    for (uint32_t l = plan->level_count; l > 0; --l) {
+        plan->level_offset[l] = plan->level_offset[l - 1];
+    }
+    plan->level_offset[0] = 0;
+
+    // now that every gate has its id, we can lay out the edges in the order of ids
+    plan->input_offset[0] = 0;
+    for (gate_id id = 0; id < plan->size; ++id) {
+        plan->input_offset[id + 1] += plan->input_offset[id];
+    }
+    for (size_t v = 0; v < s.visit_count; ++v) {
+        const struct visit *curr = &s.visits[v];
+        uint32_t *out = &plan->edges[plan->input_offset[curr->id]];
+        uint32_t count = plan->input_offset[curr->id + 1] - plan->input_offset[curr->id];
+        for (uint32_t k = 0; k < count; ++k) {
+            uint32_t in = s.edges[curr->base + k];
+            out[k] = in & SIGNAL_BIT ? in : s.visits[in].id;
+        }
+    }
+    if (s.signal_count > 0) {
+        memcpy(plan->signals, s.signals, s.signal_count * sizeof(bool*));
+    }
+    for (size_t idx = 0; idx < m; ++idx) {
+        plan->outputs[idx] = s.visits[find_mark(&s, g[idx]->index)->visit].id;
+    }
+
+    search_free(&s);
+    return 0;
+}
+
+void plan_free(Plan *plan) {
+    free(plan->kind);
+    free(plan->input_offset);
+    free(plan->critical_length);
+    free(plan->level_offset);
+    free(plan->edges);
+    free(plan->outputs);
+    free(plan->signals);
+    free(plan->gates);
+}
+
+void plan_read_signals(const Plan *plan, bool *signal_values) {
+    for (uint32_t slot = 0; slot < plan->signal_count; ++slot) {
+        signal_values[slot] = *(plan->signals[slot]);
+    }
+}
+
+void plan_evaluate_range(const Plan *plan, const bool *signal_values,
+                         bool *values, gate_id first, gate_id last) {
+    const uint32_t *edges = plan->edges;
+    for (gate_id id = first; id < last; ++id) {
+        // at least 1 false means the output is true,
+        // a gate without inputs is false
+        bool output = false;
+        uint32_t end = plan->input_offset[id + 1];
+        for (uint32_t e = plan->input_offset[id]; e < end; ++e) {
+            if (!plan_edge_value(edges[e], signal_values, values)) {
+                output = true;
+                break;
+            }
+        }
+        values[id] = output;
+    }
+}
+
+uint32_t plan_path_start(const Plan *plan) {
+    uint32_t curr = SIGNAL_BIT;
+    for (uint32_t idx = 0; idx < plan->output_count; ++idx) {
+        if (plan->outputs[idx] & SIGNAL_BIT) {
+            continue;
+        }
+        if (curr == SIGNAL_BIT ||
+            plan->critical_length[plan->outputs[idx]] > plan->critical_length[curr]) {
+            curr = plan->outputs[idx];
+        }
+    }
+    return curr;
+}
+
+// a gate of length l > 1 has an input of length l - 1, which is a gate;
+// one of length 1 has only signals (or gates without inputs) as inputs
+uint32_t plan_path_next(const Plan *plan, gate_id id) {
+    uint32_t length = plan->critical_length[id];
+    for (uint32_t e = plan->input_offset[id]; e < plan->input_offset[id + 1]; ++e) {
+        uint32_t edge = plan->edges[e];
+        if (!(edge & SIGNAL_BIT) && plan->critical_length[edge] + 1 == length) {
+            return edge;
+        }
+    }
+    return SIGNAL_BIT;
+}
+
+void plan_cache_init(PlanCache *cache) {
+    memset(cache, 0, sizeof(PlanCache));
+}
+
+void plan_cache_free(PlanCache *cache) {
+    if (cache->built) {
+        plan_free(&cache->plan);
+    }
+    free(cache->roots);
+    free(cache->signal_values);
+    free(cache->values);
+    plan_cache_init(cache);
+}
+
+bool plan_cache_valid(const PlanCache *cache, nand_t **g, size_t m, unsigned long changed) {
+    return cache->built && cache->generation >= changed && cache->root_count == m &&
+           memcmp(cache->roots, g, m * sizeof(nand_t*)) == 0;
+}
+
+int plan_cache_get(PlanCache *cache, nand_t **g, size_t m,
+                   unsigned long changed, unsigned long now) {
+    if (plan_cache_valid(cache, g, m, changed)) {
+        return 0;
+    }
+    plan_cache_free(cache);
+    if (plan_build(&cache->plan, g, m) == -1) {
+        return -1;
+    }
+    cache->built = true;
+    cache->roots = (nand_t**)malloc(m * sizeof(nand_t*));
+    cache->signal_values = (bool*)malloc(max(cache->plan.signal_count, 1) * sizeof(bool));
+    cache->values = (bool*)malloc(max(cache->plan.size, 1) * sizeof(bool));
+    if (cache->roots == NULL || cache->signal_values == NULL || cache->values == NULL) {
+        plan_cache_free(cache);
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(cache->roots, g, m * sizeof(nand_t*));
+    cache->root_count = m;
+    cache->generation = now;
+    return 0;
+}
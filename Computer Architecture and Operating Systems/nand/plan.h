@@ -0,0 +1,115 @@
+// Compact form of the cones of a set of gates used for evaluation.
+// Gates get 32-bit ids in the order of increasing level (critical path
+// length), so that every gate comes after all of its inputs and
+// evaluation is a single pass over flat arrays indexed by id.
+
+#ifndef PLAN_H
+#define PLAN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "nand.h"
+
+typedef uint32_t gate_id;
+
+// an edge with this bit set refers to a signal slot instead of a gate
+#define SIGNAL_BIT ((gate_id)1 << 31)
+#define MAX_GATES (SIGNAL_BIT - 1)
+
+// kind of a gate - a gate without inputs is the constant false
+enum GateKind {
+    KIND_NAND,
+    KIND_FALSE
+};
+
+typedef struct {
+    gate_id size;
+    uint32_t edge_count;
+    uint32_t signal_count;
+    uint32_t output_count;
+    uint32_t level_count;
+
+    // indexed by gate id
+    uint8_t *kind;
+    // inputs of gate i are edges[input_offset[i]], ..., edges[input_offset[i + 1] - 1]
+    uint32_t *input_offset;
+    uint32_t *critical_length;
+    // gates of level l have ids from level_offset[l] to level_offset[l + 1] - 1
+    uint32_t *level_offset;
+
+    // gate ids, or signal slots with SIGNAL_BIT set
+    uint32_t *edges;
+    gate_id *outputs;
+
+    // the signal connected to every slot
+    bool const **signals;
+    // the gate every id was made from
+    nand_t **gates;
+} Plan;
+
+// plan_alloc returns -1 (and sets errno to ENOMEM) if allocation failed
+int plan_alloc(Plan *plan);
+// plan_build returns -1 (and sets errno to ECANCELED or ENOMEM)
+// if the cones contain a cycle or a missing input, or allocation failed
+// the gates themselves are only read
+int plan_build(Plan *plan, nand_t **g, size_t m);
+void plan_free(Plan *plan);
+
+// the plan of the last evaluated outputs, together with the arrays
+// for the values, kept until the gates change - a plan is valid while
+// no gate of its cones got a generation higher than the one it was built at
+typedef struct {
+    Plan plan;
+    bool built;
+    unsigned long generation;
+    // the outputs the plan was built for
+    nand_t **roots;
+    size_t root_count;
+    bool *signal_values;
+    bool *values;
+} PlanCache;
+
+void plan_cache_init(PlanCache *cache);
+// whether the kept plan is for the outputs g whose gates last changed
+// at generation `changed`
+bool plan_cache_valid(const PlanCache *cache, nand_t **g, size_t m, unsigned long changed);
+// plan_cache_get returns the plan for the outputs g whose gates last changed
+// at generation `changed`, building it only if the kept one is for other
+// outputs or older - a new plan gets the generation `now`
+// returns -1 (and sets errno like plan_build) on failure
+int plan_cache_get(PlanCache *cache, nand_t **g, size_t m,
+                   unsigned long changed, unsigned long now);
+void plan_cache_free(PlanCache *cache);
+
+// reads the current values of the signals into signal_values
+void plan_read_signals(const Plan *plan, bool *signal_values);
+// evaluates the gates with ids from first to last - 1, whose inputs
+// have to be evaluated already, storing their outputs in values
+void plan_evaluate_range(const Plan *plan, const bool *signal_values,
+                         bool *values, gate_id first, gate_id last);
+// the value on the other end of an edge
+static inline bool plan_edge_value(uint32_t edge, const bool *signal_values,
+                                   const bool *values) {
+    return edge & SIGNAL_BIT ? signal_values[edge & ~SIGNAL_BIT] : values[edge];
+}
+
+// the value and the critical path length of the idx-th output
+// (an output that is a signal has length 0)
+static inline bool plan_output_value(const Plan *plan, uint32_t idx,
+                                     const bool *signal_values, const bool *values) {
+    return plan_edge_value(plan->outputs[idx], signal_values, values);
+}
+static inline uint32_t plan_output_length(const Plan *plan, uint32_t idx) {
+    return plan->outputs[idx] & SIGNAL_BIT ? 0 : plan->critical_length[plan->outputs[idx]];
+}
+
+// a longest path ending in an output, read off the critical path lengths:
+// plan_path_start gives the deepest output, and plan_path_next an input
+// of the gate exactly one level lower - both give SIGNAL_BIT where the path
+// begins with a signal (or with a gate without inputs)
+uint32_t plan_path_start(const Plan *plan);
+uint32_t plan_path_next(const Plan *plan, gate_id id);
+
+#endif //PLAN_H
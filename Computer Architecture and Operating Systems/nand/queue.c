@@ -8,9 +8,32 @@ Queue* newQueue(void) {
     if (queue == NULL) {
         return NULL;
     }
+    initQueue(queue, NULL);
+    return queue;
+}
+
+// set up an empty queue in memory that the caller has already allocated
+void initQueue(Queue* queue, Slab* slab) {
     queue -> front = queue -> rear = NULL;
     queue -> size = 0;
-    return queue;
+    queue -> slab = slab;
+}
+
+// nodes come from the slab if the queue has one, otherwise from malloc
+static Node* allocNode(Queue* queue) {
+    if (queue -> slab != NULL) {
+        return (Node*)slabAlloc(queue -> slab);
+    }
+    return (Node*)malloc(sizeof(Node));
+}
+
+static void freeNode(Queue* queue, Node* node) {
+    if (queue -> slab != NULL) {
+        slabFree(queue -> slab, node);
+    }
+    else {
+        free(node);
+    }
 }
 
 bool isEmpty(Queue* queue) {
@@ -25,12 +48,20 @@ void* front(Queue* queue) {
 // add an element to the end of the queue
 // returns -1 if allocation failed and 0 otherwise
 int push(Queue* queue, void *val) {
-    Node* newNode = (Node*)malloc(sizeof(Node));
+    return pushNode(queue, val) == NULL ? -1 : 0;
+}
+
+// add an element to the end of the queue
+// returns its node, so that it can be removed in constant time later,
+// or NULL if allocation failed
+Node* pushNode(Queue* queue, void *val) {
+    Node* newNode = allocNode(queue);
     if (newNode == NULL) {
-        return -1;
+        return NULL;
     }
     newNode -> val = val;
     newNode -> next = NULL;
+    newNode -> prev = queue -> rear;
 
     if (isEmpty(queue)) {
         queue -> front = queue -> rear = newNode;
@@ -40,7 +71,25 @@ int push(Queue* queue, void *val) {
         queue -> rear = newNode;
     }
     queue -> size++;
-    return 0;
+    return newNode;
+}
+
+// unlinks the node from its neighbours and frees it
+void removeNode(Queue* queue, Node* node) {
+    if (node -> prev != NULL) {
+        node -> prev -> next = node -> next;
+    }
+    else {
+        queue -> front = node -> next;
+    }
+    if (node -> next != NULL) {
+        node -> next -> prev = node -> prev;
+    }
+    else {
+        queue -> rear = node -> prev;
+    }
+    queue -> size--;
+    freeNode(queue, node);
 }
 
 // removes the first element from the queue that matches the pointer
@@ -51,24 +100,12 @@ void deleteNode(Queue* queue, void* ptr) {
         return;
     }
 
-    // handle the case where the target element is at the beginning of the queue
-    if (queue -> front -> val == ptr ) {
-        pop(queue);
-        return;
-    }
-
-    // if the target element is somewhere in the middle or at the end of the queue
     // we iterate through the queue and remove the target element
-    Node* curr = queue -> front;
-    while (curr -> next != NULL) {
-        if (curr -> next -> val == ptr){
-            Node* toDel = curr -> next;
-            curr -> next = curr -> next -> next;
-            queue -> size--;
-            free(toDel);
+    for (Node* curr = queue -> front; curr != NULL; curr = curr -> next) {
+        if (curr -> val == ptr) {
+            removeNode(queue, curr);
             return;
         }
-        curr = curr->next;
     }
 }
 
@@ -77,11 +114,8 @@ void* pop(Queue* queue) {
     if (isEmpty(queue)) {
         return NULL;
     }
-    void* result = front(queue);
-    Node* toDel = queue -> front;
-    queue -> front = queue -> front -> next;
-    queue -> size--;
-    free(toDel);
+    void* result = queue -> front -> val;
+    removeNode(queue, queue -> front);
     return result;
 }
 
@@ -98,10 +132,15 @@ void* iterQueue(const Queue* queue, ssize_t k) {
     return curr -> val;
 }
 
-// removes the queue and frees memory
-void freeQueue(Queue* queue) {
+// removes all elements of the queue
+void clearQueue(Queue* queue) {
     while (!isEmpty(queue)) {
         pop(queue);
     }
+}
+
+// removes the queue and frees memory
+void freeQueue(Queue* queue) {
+    clearQueue(queue);
     free(queue);
 }
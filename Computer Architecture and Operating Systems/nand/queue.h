@@ -1,16 +1,20 @@
 // A queue with the ability (in linear time) to:
 // - remove any element
 // - check the value of any element
-// The first element is removed in constant time
+// The first element is removed in constant time, and so is any element
+// whose node (returned by pushNode) we keep
 
 #ifndef QUEUE_H
 
 #include <stdbool.h>
 #include <stdlib.h>
 
+#include "arena.h"
+
 // definition of a single queue element
 typedef struct Node {
     void *val;
+    struct Node *prev;
     struct Node *next;
 } Node;
 
@@ -19,16 +23,26 @@ typedef struct {
     Node *front;
     Node *rear;
     ssize_t size;
+    // if not NULL, the nodes are taken from (and returned to) this slab
+    Slab *slab;
 } Queue;
 
 Queue* newQueue(void);
+// initializes a queue placed in memory owned by the caller
+void initQueue(Queue* queue, Slab* slab);
 bool isEmpty(Queue* queue);
 // push returns -1 if allocation failed and 0 otherwise
 int push(Queue* queue, void *val);
+// pushNode returns the node of the new element, or NULL if allocation failed
+Node* pushNode(Queue* queue, void *val);
 void deleteNode(Queue* queue, void* ptr);
+// removes the element with the given node in constant time
+void removeNode(Queue* queue, Node* node);
 void* front(Queue* queue);
 void* pop(Queue* queue);
 void* iterQueue(const Queue* queue, ssize_t k);
+// removes all elements, but not the queue itself
+void clearQueue(Queue* queue);
 void freeQueue(Queue* queue);
 
 #define QUEUE_H
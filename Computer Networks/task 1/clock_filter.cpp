@@ -0,0 +1,58 @@
+#include "clock_filter.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+void ClockFilter::add(const ClockSample& sample) {
+    samples[next] = sample;
+    // Rounding to milliseconds can make a very short round trip negative
+    samples[next].round_trip = std::max<int64_t>(sample.round_trip, 0);
+    next = (next + 1) % WINDOW;
+    count = std::min(count + 1, WINDOW);
+}
+
+const ClockSample& ClockFilter::best() const {
+    // Walks from the newest sample back, so that ties go to the newest one
+    size_t best = (next + WINDOW - 1) % WINDOW;
+    for (size_t age = 1; age < count; ++age) {
+        size_t i = (next + WINDOW - 1 - age) % WINDOW;
+        if (samples[i].round_trip < samples[best].round_trip)
+            best = i;
+    }
+    return samples[best];
+}
+
+int64_t ClockFilter::dispersion() const {
+    if (count == 0)
+        return 0;
+    int64_t offset = best().offset;
+    double sum = 0;
+    for (size_t i = 0; i < count; ++i) {
+        double difference = static_cast<double>(samples[i].offset - offset);
+        sum += difference * difference;
+    }
+    return std::llround(std::sqrt(sum / count));
+}
+
+int64_t SlewedOffset::at(TimePoint now) const {
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - since).count();
+    int64_t limit = std::max<int64_t>(elapsed, 0) * SLEW_RATE_MS_PER_S / 1000;
+    return from + std::clamp(target - from, -limit, limit);
+}
+
+void SlewedOffset::step(int64_t offset, TimePoint now) {
+    from = target = offset;
+    since = now;
+}
+
+void SlewedOffset::adjust(int64_t offset, TimePoint now) {
+    int64_t current = at(now);
+    if (std::llabs(offset - current) > STEP_THRESHOLD_MS) {
+        step(offset, now);
+        return;
+    }
+    from = current;
+    target = offset;
+    since = now;
+}
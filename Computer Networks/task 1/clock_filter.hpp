@@ -0,0 +1,60 @@
+#ifndef CLOCK_FILTER_HPP
+#define CLOCK_FILTER_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Offsets larger than this are stepped, smaller ones are slewed
+constexpr int64_t STEP_THRESHOLD_MS = 128;
+// The offset is slewed by at most this many milliseconds per second
+constexpr int64_t SLEW_RATE_MS_PER_S = 50;
+
+// One SYNC_START / DELAY_REQUEST / DELAY_RESPONSE exchange, in milliseconds
+struct ClockSample {
+    int64_t offset = 0;      // (T2 - T1 + T3 - T4) / 2
+    int64_t round_trip = 0;  // (T4 - T1) - (T3 - T2)
+};
+
+// Sliding window of the last samples from the synchronized peer. Like the
+// NTP clock filter, it trusts the sample with the shortest round trip, whose
+// offset was least distorted by queueing on the way there or back.
+class ClockFilter {
+public:
+    static constexpr size_t WINDOW = 8;
+
+    void add(const ClockSample& sample);
+    void clear() { count = 0; }
+    bool empty() const { return count == 0; }
+
+    // The sample with the shortest round trip; the filter must not be empty
+    const ClockSample& best() const;
+    // RMS difference between the offsets in the window and the best one
+    int64_t dispersion() const;
+
+private:
+    std::array<ClockSample, WINDOW> samples;
+    size_t next = 0;   // where the next sample goes
+    size_t count = 0;
+};
+
+// Clock offset which moves towards a new estimate gradually, so that the
+// synchronized time doesn't jump back and forth with every exchange
+class SlewedOffset {
+public:
+    using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+
+    int64_t at(TimePoint now) const;
+    // Jumps to offset immediately
+    void step(int64_t offset, TimePoint now);
+    // Slews to offset, or steps if it is more than STEP_THRESHOLD_MS away
+    void adjust(int64_t offset, TimePoint now);
+
+private:
+    int64_t from = 0;    // offset when the slew started
+    int64_t target = 0;
+    TimePoint since;
+};
+
+#endif // CLOCK_FILTER_HPP
@@ -0,0 +1,56 @@
+#include "delay_line.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <sys/socket.h>
+
+DelayLine::DelayLine(int fd, const Impairment& impairment)
+    : fd(fd), impairment(impairment), thread(&DelayLine::run, this) {}
+
+DelayLine::~DelayLine() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_one();
+    thread.join();
+}
+
+void DelayLine::send(ByteView datagram, const sockaddr* destination, socklen_t length) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (std::bernoulli_distribution(impairment.loss)(random))
+        return;
+    auto jitter = impairment.jitter.count();
+    auto delay = impairment.delay +
+                 std::chrono::microseconds(std::uniform_int_distribution<int64_t>(-jitter, jitter)(random));
+    delay = std::max(delay, std::chrono::microseconds(0));
+    bool earliest = pending.empty() || Clock::now() + delay < pending.top().due;
+    Pending next{Clock::now() + delay, sent++,
+                 std::vector<uint8_t>(datagram.data, datagram.data + datagram.size), {}, length};
+    memcpy(&next.destination, destination, length);
+    pending.push(std::move(next));
+    if (earliest)
+        wakeup.notify_one();
+}
+
+void DelayLine::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        if (pending.empty()) {
+            wakeup.wait(lock);
+            continue;
+        }
+        if (Clock::now() < pending.top().due) {
+            wakeup.wait_until(lock, pending.top().due);
+            continue;
+        }
+        // priority_queue only gives const access, so the datagram is copied out
+        Pending next = pending.top();
+        pending.pop();
+        lock.unlock();
+        // Like on a real network, a datagram that can't be sent is lost
+        sendto(fd, next.datagram.data(), next.datagram.size(), 0,
+               reinterpret_cast<const sockaddr*>(&next.destination), next.length);
+        lock.lock();
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef DELAY_LINE_HPP
+#define DELAY_LINE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+
+#include "message.hpp"
+
+// Network conditions to simulate on one host
+struct Impairment {
+    std::chrono::microseconds delay{0};
+    std::chrono::microseconds jitter{0};  // delay varies uniformly by up to this much
+    double loss = 0;                      // probability of dropping a datagram
+};
+
+// Sends datagrams through a socket after a random delay, or drops them,
+// so that nodes can be tested on localhost under the conditions of a real
+// network. Datagrams may be reordered, as they are sent when they are due.
+class DelayLine {
+public:
+    DelayLine(int fd, const Impairment& impairment);
+    // Stops the sending thread, dropping datagrams still on the way
+    ~DelayLine();
+    DelayLine(const DelayLine& other) = delete;
+    DelayLine& operator=(const DelayLine& other) = delete;
+
+    // destination is a socket address of either family, of the given length
+    void send(ByteView datagram, const sockaddr* destination, socklen_t length);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Pending {
+        Clock::time_point due;
+        uint64_t order;  // keeps datagrams due at the same time in order
+        std::vector<uint8_t> datagram;
+        sockaddr_storage destination;
+        socklen_t length;
+        bool operator>(const Pending& other) const {
+            return due != other.due ? due > other.due : order > other.order;
+        }
+    };
+
+    void run();
+
+    int fd;
+    Impairment impairment;
+    std::mt19937_64 random{std::random_device{}()};
+    uint64_t sent = 0;
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>> pending;
+    bool stopping = false;
+    std::thread thread;  // started last, once everything it uses exists
+};
+
+#endif // DELAY_LINE_HPP
@@ -0,0 +1,112 @@
+// Prints an event log written by peer-time-sync -l as text, one event
+// per line, with the wall clock time at which it happened
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <ctime>
+
+#include "event_log.hpp"
+#include "message.hpp"
+
+constexpr int64_t NANOSECONDS = 1000000000;
+
+static const char* get_event_kind_name(EventKind kind) {
+    switch (kind) {
+        case EventKind::RECEIVED: return "RECEIVED";
+        case EventKind::SENT: return "SENT";
+        case EventKind::OFFSET: return "OFFSET";
+        case EventKind::SYNC_LOST: return "SYNC_LOST";
+        case EventKind::LEVEL: return "LEVEL";
+        case EventKind::DROPPED: return "DROPPED";
+        default: return "UNKNOWN";
+    }
+}
+
+// UTC, with microseconds
+static std::string format_time(int64_t nanoseconds) {
+    time_t seconds = static_cast<time_t>(nanoseconds / NANOSECONDS);
+    tm utc;
+    gmtime_r(&seconds, &utc);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &utc);
+    std::ostringstream out;
+    out << date << "." << std::setw(6) << std::setfill('0')
+        << (nanoseconds % NANOSECONDS) / 1000 << "Z";
+    return out.str();
+}
+
+static void print_record(const EventRecord& record, int64_t opened) {
+    std::cout << format_time(opened + record.time) << " thread=" << static_cast<int>(record.thread)
+              << " " << get_event_kind_name(record.kind);
+    switch (record.kind) {
+        case EventKind::RECEIVED:
+        case EventKind::SENT:
+            std::cout << " " << get_message_type_name(record.type) << " size=" << record.value;
+            break;
+        case EventKind::OFFSET:
+            std::cout << " level=" << static_cast<int>(record.type) << " offset=" << record.value
+                      << "ms round_trip=" << record.extra << "ms";
+            break;
+        case EventKind::LEVEL:
+            std::cout << " level=" << static_cast<int>(record.type);
+            break;
+        case EventKind::DROPPED:
+            std::cout << " count=" << record.value;
+            break;
+        default:
+            break;
+    }
+    if (record.has_peer)
+        std::cout << " peer=" << format_address(record.peer.address) << ":" << record.peer.port;
+    std::cout << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2 || std::string(argv[1]) == "-h") {
+        std::cerr << "Usage:\n"
+                  << "  ./event-decode event_log\n";
+        return 1;
+    }
+    std::ifstream file(argv[1], std::ios::binary);
+    if (!file) {
+        std::cerr << "ERROR Cannot open " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::vector<uint8_t> header(EVENT_LOG_HEADER_SIZE);
+    if (!file.read(reinterpret_cast<char*>(header.data()), header.size()) ||
+        !std::equal(EVENT_LOG_MAGIC.begin(), EVENT_LOG_MAGIC.end(), header.begin())) {
+        std::cerr << "ERROR " << argv[1] << " is not an event log" << std::endl;
+        return 1;
+    }
+    int64_t opened = get_i64(header.data() + EVENT_LOG_MAGIC.size());
+
+    // Read in chunks, keeping a record cut at the end of one for the next
+    std::vector<uint8_t> buffer(1 << 20);
+    size_t filled = 0;
+    while (file) {
+        file.read(reinterpret_cast<char*>(buffer.data() + filled), buffer.size() - filled);
+        filled += file.gcount();
+        size_t offset = 0;
+        EventRecord record;
+        while (size_t size = decode_event_record(ByteView{buffer.data() + offset, filled - offset},
+                                                 record)) {
+            print_record(record, opened);
+            offset += size;
+        }
+        if (offset == 0 && filled == buffer.size())
+            break;  // no record is this long, so it isn't one
+        std::copy(buffer.begin() + offset, buffer.begin() + filled, buffer.begin());
+        filled -= offset;
+    }
+    // A write cut short, e.g. by a full disk, leaves a partial record
+    if (filled > 0) {
+        std::cerr << "ERROR " << filled << " octets at the end are not a valid event" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,149 @@
+#include "event_log.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+
+EventLog::~EventLog() {
+    close();
+}
+
+void EventLog::open(const std::string& path) {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        throw std::runtime_error("Cannot open event log " + path + ": " + std::string(strerror(errno)));
+
+    start = Clock::now();
+    auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch());
+    output.resize(EVENT_LOG_HEADER_SIZE);
+    memcpy(output.data(), EVENT_LOG_MAGIC.data(), EVENT_LOG_MAGIC.size());
+    put_i64(output.data() + EVENT_LOG_MAGIC.size(), wall.count());
+
+    active.store(true, std::memory_order_relaxed);
+    thread = std::thread(&EventLog::run, this);
+}
+
+void EventLog::close() {
+    if (!thread.joinable())
+        return;
+    active.store(false, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_one();
+    thread.join();
+    ::close(fd);
+    fd = -1;
+}
+
+void EventLog::push(EventKind kind, uint8_t type, const Peer* peer, int64_t value, int64_t extra,
+                    Clock::time_point time) {
+    // Before ring(), which is slow the first time a thread records
+    if (time == Clock::time_point())
+        time = Clock::now();
+    Ring* mine = ring();
+    uint64_t head = mine->head.load(std::memory_order_relaxed);
+    if (head - mine->tail.load(std::memory_order_acquire) == RING_SIZE) {
+        mine->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Event& event = mine->events[head % RING_SIZE];
+    event.time = time;
+    event.value = value;
+    event.extra = extra;
+    event.has_peer = peer != nullptr;
+    if (peer != nullptr)
+        event.peer = *peer;
+    event.kind = kind;
+    event.type = type;
+    // The flushing thread reads the event once it sees the new head
+    mine->head.store(head + 1, std::memory_order_release);
+}
+
+EventLog::Ring* EventLog::ring() {
+    thread_local const EventLog* owner = nullptr;
+    thread_local Ring* mine = nullptr;
+    if (owner != this) {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(std::make_unique<Ring>());
+        mine = rings.back().get();
+        mine->thread = static_cast<uint8_t>(std::min<size_t>(rings.size() - 1, UINT8_MAX));
+        owner = this;
+    }
+    return mine;
+}
+
+void EventLog::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wakeup.wait_for(lock, FLUSH_INTERVAL, [this] { return stopping; });
+        bool last = stopping;
+        lock.unlock();
+        if (!flush()) {
+            std::cerr << "ERROR event log: " << strerror(errno) << std::endl;
+            active.store(false, std::memory_order_relaxed);
+            return;
+        }
+        if (last)
+            return;
+        lock.lock();
+    }
+}
+
+bool EventLog::flush() {
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        for (const auto& ring : rings) {
+            uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            size_t offset = output.size();
+            output.resize(offset + (head - tail + 1) * EVENT_RECORD_MAX_SIZE);
+            for (; tail != head; ++tail) {
+                const Event& event = ring->events[tail % RING_SIZE];
+                EventRecord record;
+                record.kind = event.kind;
+                record.type = event.type;
+                record.thread = ring->thread;
+                record.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    event.time - start).count();
+                record.value = event.value;
+                record.extra = event.extra;
+                record.has_peer = event.has_peer;
+                record.peer = event.peer;
+                offset += encode_event_record(record, output.data() + offset);
+            }
+            // The events are copied out, the thread may reuse their slots
+            ring->tail.store(tail, std::memory_order_release);
+
+            uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped > 0) {
+                EventRecord record;
+                record.kind = EventKind::DROPPED;
+                record.thread = ring->thread;
+                record.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Clock::now() - start).count();
+                record.value = static_cast<int64_t>(dropped);
+                offset += encode_event_record(record, output.data() + offset);
+            }
+            output.resize(offset);
+        }
+    }
+
+    size_t written = 0;
+    while (written < output.size()) {
+        ssize_t result = write(fd, output.data() + written, output.size() - written);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result < 0)
+            return false;
+        written += result;
+    }
+    output.clear();
+    return true;
+}
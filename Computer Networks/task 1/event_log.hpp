@@ -0,0 +1,151 @@
+#ifndef EVENT_LOG_HPP
+#define EVENT_LOG_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "message.hpp"
+
+// What an event records; value and extra depend on the kind
+enum class EventKind : uint8_t {
+    RECEIVED = 1,   // type: message type, value: datagram size
+    SENT = 2,       // type: message type, value: datagram size
+    OFFSET = 3,     // type: new sync level, peer: synchronized peer,
+                    // value: offset (ms), extra: round trip (ms)
+    SYNC_LOST = 4,  // peer: the peer we were synchronized with
+    LEVEL = 5,      // type: new sync level, set by LEADER
+    DROPPED = 6,    // value: events lost because the thread's ring was full
+};
+
+// An event as written to the file
+struct EventRecord {
+    EventKind kind = EventKind::RECEIVED;
+    uint8_t type = 0;
+    uint8_t thread = 0;  // in the order threads first recorded an event
+    int64_t time = 0;    // nanoseconds since the log was opened
+    int64_t value = 0;
+    int64_t extra = 0;
+    bool has_peer = false;
+    Peer peer;
+};
+
+// The file starts with EVENT_LOG_MAGIC and the wall clock time at which it
+// was opened (8 octets, nanoseconds since the epoch), followed by records:
+// kind, type, thread (1 octet each), time, value, extra (8 octets each) and
+// the peer as in HELLO_REPLY, or a 0 length octet if there is none.
+// Multi-octet fields are in network byte order, as in messages.
+constexpr std::array<uint8_t, 8> EVENT_LOG_MAGIC = {'P', 'T', 'S', 'E', 'V', 'L', 'O', 'G'};
+constexpr size_t EVENT_LOG_HEADER_SIZE = EVENT_LOG_MAGIC.size() + 8;
+constexpr size_t EVENT_RECORD_MAX_SIZE = 3 + 3 * 8 + IPV6_PEER_RECORD_SIZE;
+
+inline size_t encode_event_record(const EventRecord& record, uint8_t* out) {
+    out[0] = static_cast<uint8_t>(record.kind);
+    out[1] = record.type;
+    out[2] = record.thread;
+    put_i64(out + 3, record.time);
+    put_i64(out + 11, record.value);
+    put_i64(out + 19, record.extra);
+    if (!record.has_peer) {
+        out[27] = 0;
+        return 28;
+    }
+    return 27 + encode_peer(out + 27, record.peer);
+}
+
+// Returns the size of the record at the beginning of in, 0 if it is
+// truncated or invalid
+inline size_t decode_event_record(ByteView in, EventRecord& record) {
+    if (in.size < 28)
+        return 0;
+    record.kind = static_cast<EventKind>(in.data[0]);
+    record.type = in.data[1];
+    record.thread = in.data[2];
+    record.time = get_i64(in.data + 3);
+    record.value = get_i64(in.data + 11);
+    record.extra = get_i64(in.data + 19);
+    record.has_peer = in.data[27] != 0;
+    if (!record.has_peer)
+        return 28;
+    size_t size = decode_peer(ByteView{in.data + 27, in.size - 27}, record.peer);
+    return size == 0 ? 0 : 27 + size;
+}
+
+// Tracing cheap enough to leave on: every thread records events into its
+// own ring without locking, and a background thread flushes the rings into
+// a binary file every FLUSH_INTERVAL. If a thread records faster than that,
+// its ring fills up and the events it can't take are counted as DROPPED
+// instead of slowing the thread down.
+class EventLog {
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t RING_SIZE = 8192;  // events per thread, a power of two
+    static constexpr std::chrono::milliseconds FLUSH_INTERVAL{100};
+
+    EventLog() = default;
+    ~EventLog();
+    EventLog(const EventLog& other) = delete;
+    EventLog& operator=(const EventLog& other) = delete;
+
+    // Truncates the file and starts the flushing thread
+    void open(const std::string& path);
+    // Flushes what has been recorded and stops; later events are ignored
+    void close();
+
+    // Can be called from any thread; never blocks but the first time a
+    // thread records. `time` defaults to now.
+    void record(EventKind kind, uint8_t type, const Peer* peer, int64_t value = 0,
+                int64_t extra = 0, Clock::time_point time = Clock::time_point()) {
+        if (active.load(std::memory_order_relaxed))
+            push(kind, type, peer, value, extra, time);
+    }
+
+private:
+    struct Event {
+        Clock::time_point time;
+        int64_t value;
+        int64_t extra;
+        Peer peer;
+        EventKind kind;
+        uint8_t type;
+        bool has_peer;
+    };
+
+    // Single producer (its thread), single consumer (the flushing thread)
+    struct Ring {
+        std::array<Event, RING_SIZE> events;
+        alignas(64) std::atomic<uint64_t> head{0};  // next to write
+        alignas(64) std::atomic<uint64_t> tail{0};  // next to flush
+        std::atomic<uint64_t> dropped{0};
+        uint8_t thread = 0;
+    };
+
+    void push(EventKind kind, uint8_t type, const Peer* peer, int64_t value, int64_t extra,
+              Clock::time_point time);
+    Ring* ring();
+    void run();
+    // Writes out everything in the rings, returns false on a write error
+    bool flush();
+
+    int fd = -1;
+    Clock::time_point start;
+    std::atomic<bool> active{false};
+
+    std::mutex rings_mutex;  // only taken when a thread records for the first time
+    std::vector<std::unique_ptr<Ring>> rings;
+    std::vector<uint8_t> output;  // used by the flushing thread
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+    std::thread thread;
+};
+
+#endif // EVENT_LOG_HPP
@@ -0,0 +1,45 @@
+#include "inbox.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+Inbox::Inbox() {
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0)
+        throw std::runtime_error("eventfd() failed: " + std::string(strerror(errno)));
+}
+
+Inbox::~Inbox() {
+    close(event_fd);
+}
+
+void Inbox::push(ByteView datagram, const Peer& sender, std::chrono::steady_clock::time_point time,
+                 bool answered) {
+    bool was_empty;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        was_empty = pending.empty();
+        pending.push_back({std::vector<uint8_t>(datagram.data, datagram.data + datagram.size),
+                           sender, time, answered});
+    }
+    // One wakeup is enough until the reactor takes the entries
+    if (was_empty) {
+        uint64_t one = 1;
+        if (write(event_fd, &one, sizeof(one)) != sizeof(one))
+            throw std::runtime_error("eventfd write failed: " + std::string(strerror(errno)));
+    }
+}
+
+void Inbox::take(std::vector<Entry>& entries) {
+    uint64_t count;
+    // Reset the counter first, so that a push after the swap wakes us up again
+    if (read(event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        throw std::runtime_error("eventfd read failed: " + std::string(strerror(errno)));
+    entries.clear();
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.swap(pending);
+}
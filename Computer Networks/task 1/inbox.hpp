@@ -0,0 +1,41 @@
+#ifndef INBOX_HPP
+#define INBOX_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "message.hpp"
+
+// Datagrams received by the receiver threads and handed over to the thread
+// running the reactor, which alone changes the peer tables and the sync
+// state. The descriptor becomes readable whenever something was pushed.
+class Inbox {
+public:
+    struct Entry {
+        std::vector<uint8_t> datagram;
+        Peer sender;
+        std::chrono::steady_clock::time_point time;  // when it was received
+        bool answered;  // already answered by the receiver thread
+    };
+
+    Inbox();
+    ~Inbox();
+    Inbox(const Inbox& other) = delete;
+    Inbox& operator=(const Inbox& other) = delete;
+
+    void push(ByteView datagram, const Peer& sender, std::chrono::steady_clock::time_point time,
+              bool answered = false);
+    // Swaps everything pushed so far into entries, whose old contents are dropped
+    void take(std::vector<Entry>& entries);
+
+    int get_fd() const { return event_fd; }
+
+private:
+    int event_fd;
+    std::mutex mutex;
+    std::vector<Entry> pending;
+};
+
+#endif // INBOX_HPP
@@ -1,82 +1,415 @@
 #include <iostream>
+#include <iomanip>
 #include <string>
+#include <cstdio>
 #include <cstdlib>
 #include <sys/socket.h>
 #include <vector>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <algorithm>
+#include <array>
 #include <chrono>
+#include <random>
+#include <thread>
+#include <csignal>
+#include <sys/signalfd.h>
+#include <unistd.h>
 
+#include "clock_filter.hpp"
+#include "event_log.hpp"
+#include "inbox.hpp"
 #include "network.hpp"
 #include "message.hpp"
+#include "outbound_queue.hpp"
+#include "overlay.hpp"
+#include "peer_cache.hpp"
+#include "peer_table.hpp"
+#include "reactor.hpp"
+#include "sync_snapshot.hpp"
+
+using namespace std::chrono_literals;
+
+// SYNC_START is sent every SYNC_INTERVAL, the first time LEADER_DELAY
+// after becoming the leader
+constexpr std::chrono::milliseconds SYNC_INTERVAL = 5s;
+constexpr std::chrono::milliseconds LEADER_DELAY = 2s;
+// Synchronization is lost without SYNC_START from the synchronized peer for this long
+constexpr std::chrono::milliseconds SYNC_LOSS_TIMEOUT = 20s;
+// HELLO and CONNECT are retransmitted after RETRY_INTERVAL, doubling it
+// every time, at most MAX_RETRIES times
+constexpr std::chrono::milliseconds RETRY_INTERVAL = 1s;
+constexpr unsigned MAX_RETRIES = 4;
+// Every GOSSIP_INTERVAL the peers learned since the last round, at most
+// GOSSIP_MAX_PEERS of them, are sent to GOSSIP_FANOUT distinct random peers
+constexpr std::chrono::milliseconds GOSSIP_INTERVAL = 2s;
+constexpr unsigned GOSSIP_FANOUT = 3;
+constexpr size_t GOSSIP_MAX_PEERS = 256;
+// The peer cache is saved this often if the peers or the sync parent changed
+constexpr std::chrono::milliseconds CACHE_INTERVAL = 10s;
+constexpr unsigned MAX_THREADS = 64;
+
+void stamp_datagram(ByteSpan datagram, const Peer& peer,
+                    std::chrono::time_point<std::chrono::steady_clock> now);
 
 struct Node {
-    std::array<Peer, MAX_PEERS> peers = {Peer()};
-    uint16_t peer_count = 0;
+    PeerTable peers;
     uint16_t port = 0;
     uint16_t peer_port = 0;
-    int64_t curr_time_offset = 0;
-    int64_t next_time_offset = 0;
+    SlewedOffset time_offset;
+    ClockFilter clock_filter;  // samples from the synchronized peer
+    // T1, T2 and T3 of the exchange with the synchronizing peer
+    int64_t t1 = 0;
+    int64_t t2 = 0;
+    int64_t t3 = 0;
     uint8_t sync_level = 255; // Default sync level
     bool connect_to_peer = false;
     bool isSynchronizing = false;
-    uint32_t synchronized_peer_ip = 0;
+    Address synchronized_peer_ip{};
     uint16_t synchronized_peer_port = 0;
-    uint32_t synchronizing_peer_ip = 0;
+    Address synchronizing_peer_ip{};
     uint16_t synchronizing_peer_port = 0;
     UdpSocket socket;
-    std::vector<Peer> unack_peers;
+    PeerTable unack_peers;  // peers we sent CONNECT to and wait for ACK_CONNECT
     std::string bind_address = "0.0.0.0";
     std::string peer_address = "";
     std::chrono::time_point<std::chrono::steady_clock> start_time;
     std::chrono::time_point<std::chrono::steady_clock> last_sync_time; // Last time we received SYNC_START from our synchronized peer
-    
+
+    Reactor reactor;
+    // Everything but the receiver threads' answers is sent through it
+    OutboundQueue outbound{socket, reactor, stamp_datagram};
+    int sync_timer = -1;       // periodic SYNC_START broadcast
+    int sync_loss_timer = -1;  // no SYNC_START from the synchronized peer for too long
+    int retry_timer = -1;      // HELLO and CONNECT retransmissions
+    unsigned retries = 0;
+    bool joining = false;      // waiting for HELLO_REPLY from join_target
+    Peer join_target;
+
+    int gossip_timer = -1;
+    size_t gossip_cursor = 0;  // peers before it have been gossiped
+    std::mt19937 random{std::random_device{}()};
+
+    // Tree mode (-m tree): SYNC_START goes to the children and a few random
+    // peers instead of all peers, and we sync with the best of our parents
+    bool tree = false;
+    ParentSet parents;
+    ChildSet children;
+    std::chrono::time_point<std::chrono::steady_clock> last_sync_start;  // sent by us
+
+    // With more than one receiver thread, the other threads answer GET_TIME
+    // and DELAY_REQUEST on their own sockets from `snapshot` and `known`,
+    // and pass everything else through `inbox` to the thread running the
+    // reactor, the only one which changes the state above
+    unsigned threads = 1;
+    bool impaired = false;  // -i, for testing with the simulator
+    Impairment impairment;
+    SharedPeerSet known;  // node.peers, readable from any thread
+    SyncSnapshot snapshot;
+    Inbox inbox;
+    std::vector<Inbox::Entry> forwarded;  // taken from inbox, reused
+
+    std::string event_log_path;  // -l, no event log if empty
+    EventLog event_log;
+
+    // Peer cache (-c): the peers and the last peer we synced to, saved
+    // every CACHE_INTERVAL if they changed and restored on start
+    std::string peer_cache_path;  // no cache if empty
+    int cache_timer = -1;
+    Peer last_parent;             // port 0 if none yet
+    size_t cached_peers = 0;      // as last saved
+    Peer cached_parent;
+    bool restoring = false;       // sending CONNECT to the cached peers
+    Peer restored_parent;         // not yet answered ACK_CONNECT
 };
 
 static Node node;
 
+// Milliseconds since the node started
+int64_t natural_time(std::chrono::time_point<std::chrono::steady_clock> when) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(when - node.start_time).count();
+}
+
+// The time we send to other nodes: corrected by the offset if synchronized
+int64_t node_time(std::chrono::time_point<std::chrono::steady_clock> when) {
+    int64_t time = natural_time(when);
+    if (node.sync_level < 255) {
+        time -= node.time_offset.at(when);
+    }
+    return time;
+}
+
+// Called by the outbound queue right before a datagram is sent, also after
+// it had to wait: T1 in SYNC_START and the time in TIME are when it is
+// sent, and so is T3, kept until DELAY_RESPONSE comes
+void stamp_datagram(ByteSpan datagram, const Peer& peer,
+                    std::chrono::time_point<std::chrono::steady_clock> now) {
+    switch (getMessageType(ByteView{datagram.data, datagram.size})) {
+        case SYNC_START:
+        case TIME:
+            put_i64(datagram.data + TIMESTAMP_OFFSET, node_time(now));
+            break;
+        case DELAY_REQUEST:
+            if (node.tree) {
+                Parent* parent = node.parents.find(peer);
+                if (parent != nullptr && parent->pending)
+                    parent->t3 = natural_time(now);
+            } else if (node.isSynchronizing && node.synchronizing_peer_ip == peer.address &&
+                       node.synchronizing_peer_port == peer.port) {
+                node.t3 = natural_time(now);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Makes changes to the sync level or the offset visible to all threads
+void publish_sync() {
+    SyncState state;
+    state.sync_level = node.sync_level;
+    state.offset = node.time_offset;
+    // The leader and unsynchronized nodes have no samples to report
+    if (node.sync_level > 0 && node.sync_level < 255 && !node.clock_filter.empty()) {
+        state.round_trip = static_cast<uint32_t>(node.clock_filter.best().round_trip);
+        state.dispersion = static_cast<uint32_t>(node.clock_filter.dispersion());
+    }
+    node.snapshot.publish(state);
+}
+
+// Forgets the synchronized peer and the samples taken from it
+void lose_sync() {
+    if (node.sync_level < 255 && node.synchronized_peer_port != 0) {
+        Peer lost(node.synchronized_peer_ip, node.synchronized_peer_port);
+        node.event_log.record(EventKind::SYNC_LOST, 255, &lost);
+    }
+    node.sync_level = 255;
+    node.synchronized_peer_ip = Address{};
+    node.synchronized_peer_port = 0;
+    node.clock_filter.clear();
+    node.time_offset.step(0, std::chrono::steady_clock::now());
+    publish_sync();
+}
+
+// Takes the offset measured in an exchange with the peer we sync to,
+// which is at `level`
+void apply_sample(const ClockSample& sample, const Peer& sender, uint8_t level,
+                  std::chrono::time_point<std::chrono::steady_clock> now) {
+    // Samples from another peer say nothing about this one
+    bool same_peer = node.synchronized_peer_ip == sender.address &&
+                     node.synchronized_peer_port == sender.port;
+    if (!same_peer) {
+        node.clock_filter.clear();
+    }
+    node.clock_filter.add(sample);
+    int64_t offset = node.clock_filter.best().offset;
+    if (node.sync_level == 255) {
+        node.time_offset.step(offset, now);
+    } else {
+        node.time_offset.adjust(offset, now);
+    }
+    node.sync_level = level + 1;
+    node.synchronized_peer_ip = sender.address;
+    node.synchronized_peer_port = sender.port;
+    node.last_parent = sender;
+    node.event_log.record(EventKind::OFFSET, node.sync_level, &sender, offset,
+                          node.clock_filter.best().round_trip, now);
+    publish_sync();
+}
+
+// Adds a peer to the peer table, returns false if it was already there or the table is full
+bool add_peer(const Peer& peer) {
+    if (!node.peers.insert(peer))
+        return false;
+    node.known.insert(peer);
+    return true;
+}
+
+// Sends HELLO to the peer given with -a and -r, the reply is handled
+// in handle_message and HELLO is retransmitted by on_retry until it comes
 void connect_to_peer () {
+    // Resolved once, so that replies are matched by address and not by string
+    node.join_target = UdpSocket::resolve(node.peer_address, node.peer_port);
+    node.joining = true;
+    node.retries = 0;
     Hello hello;
-    node.socket.send_to(hello, node.peer_address, node.peer_port);
-    std::string sender_ip = "";
-    uint16_t sender_port = -1;
-    size_t received;
-    
-    // Wait for a HELLO_REPLY message from the peer we're trying to connect to
-    do {
-        received = node.socket.recv_from(sender_ip, sender_port);
-        
-        if (received < 1) continue; // Skip empty messages
-        
-        if (sender_ip == node.peer_address && 
-            sender_port == node.peer_port && 
-            getMessageType(node.socket.buffer) == HELLO_REPLY) {
-            break;  // Found the message we're looking for
-        }
-    } while (true);
-    // Now deserialize the message as a HelloReply
-    HelloReply hello_reply(node.socket.buffer);
+    node.outbound.send_to(hello, node.join_target);
+    node.reactor.arm(node.retry_timer, RETRY_INTERVAL);
+}
 
-    node.peers[node.peer_count++] = Peer(sender_ip, sender_port);
-    
-    node.unack_peers = hello_reply.peers;
-    for (Peer& peer : node.unack_peers) {
-        // Convert IP address from network byte order to string and back
-        // to fix the byte order issue
-        char ip_buf[INET_ADDRSTRLEN];
-        struct in_addr addr;
-        addr.s_addr = peer.address;
-        inet_ntop(AF_INET, &addr, ip_buf, sizeof(ip_buf));
-        std::string peer_ip(ip_buf);
-        
+// Retransmits HELLO while joining, or else CONNECT to the peers
+// which haven't answered with ACK_CONNECT yet
+void on_retry() {
+    if (!node.joining && node.unack_peers.size() == 0)
+        return;
+    if (node.retries == MAX_RETRIES) {
+        if (node.joining) {
+            std::cerr << "ERROR no HELLO_REPLY from " << node.peer_address << ":"
+                      << node.peer_port << std::endl;
+        }
+        node.joining = false;
+        node.restoring = false;
+        node.unack_peers.clear();
+        return;
+    }
+    // None of the cached peers answered in time, so we join as without
+    // a cache; they still get CONNECT with the peers from HELLO_REPLY
+    if (node.restoring && node.peers.size() == 0 && node.connect_to_peer) {
+        node.restoring = false;
+        connect_to_peer();
+        return;
+    }
+    ++node.retries;
+    if (node.joining) {
+        Hello hello;
+        node.outbound.send_to(hello, node.join_target);
+    } else {
         Connect connect;
-        node.socket.send_to(connect, peer_ip, peer.port);
+        node.outbound.send_many(connect, node.unack_peers.begin(), node.unack_peers.size());
+    }
+    // Up to half of the interval at random on top, so that nodes restarted
+    // together don't retry together
+    auto interval = RETRY_INTERVAL * (1 << node.retries);
+    auto jitter = std::uniform_int_distribution<int64_t>(0, interval.count() / 2)(node.random);
+    node.reactor.arm(node.retry_timer, interval + std::chrono::milliseconds(jitter));
+}
+
+// Sends CONNECT to the peers saved before a restart, the last sync parent
+// first; returns false if there are none
+bool restore_peers() {
+    PeerCache cache;
+    if (!load_peer_cache(node.peer_cache_path, cache)) {
+        if (access(node.peer_cache_path.c_str(), F_OK) == 0)
+            std::cerr << "ERROR invalid peer cache " << node.peer_cache_path << std::endl;
+        return false;
+    }
+    if (cache.has_parent) {
+        node.unack_peers.insert(cache.parent);
+        node.last_parent = cache.parent;
+        node.restored_parent = cache.parent;
+    }
+    for (const Peer& peer : cache.peers)
+        node.unack_peers.insert(peer);
+    if (node.unack_peers.size() == 0)
+        return false;
+
+    node.cached_peers = cache.peers.size();
+    node.cached_parent = node.last_parent;
+    node.restoring = true;
+    node.retries = 0;
+    Connect connect;
+    node.outbound.send_many(connect, node.unack_peers.begin(), node.unack_peers.size());
+    node.reactor.arm(node.retry_timer, RETRY_INTERVAL);
+    return true;
+}
+
+void save_cache() {
+    const Peer* parent = node.last_parent.port != 0 ? &node.last_parent : nullptr;
+    if (!save_peer_cache(node.peer_cache_path, node.peers.begin(), node.peers.size(), parent)) {
+        std::cerr << "ERROR cannot save peer cache " << node.peer_cache_path << std::endl;
+        return;
+    }
+    node.cached_peers = node.peers.size();
+    node.cached_parent = node.last_parent;
+}
+
+void on_cache_timer() {
+    // Peers are only ever added, so a new one changes the count
+    if (node.peers.size() != node.cached_peers || node.last_parent != node.cached_parent)
+        save_cache();
+}
+
+// Sends SYNC_START with the current time to all known peers
+void on_sync_timer() {
+    auto now = std::chrono::steady_clock::now();
+    if (node.tree) {
+        node.children.expire(now - SYNC_LOSS_TIMEOUT);
+        node.parents.prune(now - SYNC_LOSS_TIMEOUT, node.sync_level);
+    }
+    if (node.sync_level >= 254)
+        return;
+    SyncStart sync_start{node.sync_level, node_time(now)};
+    if (!node.tree) {
+        node.outbound.send_many(sync_start, node.peers.begin(), node.peers.size());
+        return;
+    }
+    // The children, and a few random peers which may need a parent
+    node.outbound.send_many(sync_start, node.children.begin(), node.children.size());
+    if (node.peers.size() > 0) {
+        std::uniform_int_distribution<size_t> pick(0, node.peers.size() - 1);
+        for (size_t i = 0; i < TREE_PROBES; ++i) {
+            const Peer& peer = node.peers[pick(node.random)];
+            if (!node.children.contains(peer))
+                node.outbound.send_to(sync_start, peer);
+        }
+    }
+    node.last_sync_start = now;
+}
+
+// Sends the peers learned since the last round to a few random peers, which
+// connect to those they don't know and pass them on in their own rounds, so
+// a new peer reaches the whole network in a logarithmic number of rounds
+void on_gossip() {
+    size_t end = std::min(node.peers.size(), node.gossip_cursor + GOSSIP_MAX_PEERS);
+    if (end == node.gossip_cursor)
+        return;
+    // GOSSIP_FANOUT distinct targets (Floyd's sampling): every j adds a random
+    // index up to j, or j itself if that one was taken already
+    std::array<size_t, GOSSIP_FANOUT> targets;
+    size_t count = 0;
+    for (size_t j = node.peers.size() - std::min<size_t>(GOSSIP_FANOUT, node.peers.size());
+         j < node.peers.size(); ++j) {
+        size_t index = std::uniform_int_distribution<size_t>(0, j)(node.random);
+        if (std::find(targets.begin(), targets.begin() + count, index) != targets.begin() + count)
+            index = j;
+        targets[count++] = index;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const Peer& target = node.peers[targets[i]];
+        size_t size = encode_peer_list(GOSSIP, node.peers.begin(), end, node.gossip_cursor,
+                                       target, node.socket.send_buffer());
+        // Nothing to send if the target is the only new peer
+        if (size > HELLO_REPLY_HEADER_SIZE)
+            node.outbound.send_to(ByteSpan{node.socket.buffer.data(), size}, target);
+    }
+    node.gossip_cursor = end;
+}
+
+// Records that the synchronized (or synchronizing) peer is alive
+void mark_sync_alive() {
+    node.last_sync_time = std::chrono::steady_clock::now();
+    node.reactor.arm(node.sync_loss_timer, SYNC_LOSS_TIMEOUT);
+}
+
+// Drops a parent in tree mode. If it was the one we synced to, the best of
+// the others takes over with its next exchange; if none are left, we fall
+// back to the whole peer set: DELAY_REQUEST makes every synchronized peer
+// with room take us as a child and send us SYNC_START.
+void lose_parent(const Peer& parent) {
+    node.parents.remove(parent);
+    if (node.synchronized_peer_ip != parent.address || node.synchronized_peer_port != parent.port)
+        return;
+    lose_sync();
+    if (node.parents.empty()) {
+        DelayRequest delay_request;
+        node.outbound.send_many(delay_request, node.peers.begin(), node.peers.size());
+    }
+}
+
+// We haven't received SYNC_START from our synchronized peer for too long
+void on_sync_loss() {
+    if (node.sync_level < 255 && node.synchronized_peer_port != 0) {
+        if (node.tree) {
+            lose_parent(Peer(node.synchronized_peer_ip, node.synchronized_peer_port));
+        } else {
+            lose_sync();
+        }
     }
 }
 
 bool parse_arguments(int argc, char* argv[]) {
-    bool has_b = false, has_p = false, has_a = false, has_r = false;
+    bool has_b = false, has_p = false, has_a = false, has_r = false, has_t = false, has_i = false, has_m = false,
+         has_l = false, has_c = false;
 
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
@@ -117,6 +450,66 @@ bool parse_arguments(int argc, char* argv[]) {
                 ++i;
             }
         }
+        else if (arg == "-t" && i + 1 < argc) {
+            if (!has_t) {
+                int threads = std::atoi(argv[++i]);
+                if (threads < 1 || threads > static_cast<int>(MAX_THREADS)) {
+                    std::cerr << "Error: threads must be in range 1–" << MAX_THREADS << ".\n";
+                    return false;
+                }
+                node.threads = threads;
+                has_t = true;
+            } else {
+                ++i;
+            }
+        }
+        else if (arg == "-m" && i + 1 < argc) {
+            if (!has_m) {
+                std::string mode = argv[++i];
+                if (mode != "mesh" && mode != "tree") {
+                    std::cerr << "Error: mode must be mesh or tree.\n";
+                    return false;
+                }
+                node.tree = mode == "tree";
+                has_m = true;
+            } else {
+                ++i;
+            }
+        }
+        else if (arg == "-i" && i + 1 < argc) {
+            if (!has_i) {
+                double delay, jitter, loss;
+                char end;
+                if (std::sscanf(argv[++i], "%lf,%lf,%lf%c", &delay, &jitter, &loss, &end) != 3 ||
+                    delay < 0 || jitter < 0 || loss < 0 || loss > 100) {
+                    std::cerr << "Error: -i takes delay_ms,jitter_ms,loss_percent.\n";
+                    return false;
+                }
+                node.impaired = true;
+                node.impairment.delay = std::chrono::microseconds(static_cast<int64_t>(delay * 1000));
+                node.impairment.jitter = std::chrono::microseconds(static_cast<int64_t>(jitter * 1000));
+                node.impairment.loss = loss / 100;
+                has_i = true;
+            } else {
+                ++i;
+            }
+        }
+        else if (arg == "-c" && i + 1 < argc) {
+            if (!has_c) {
+                node.peer_cache_path = argv[++i];
+                has_c = true;
+            } else {
+                ++i;
+            }
+        }
+        else if (arg == "-l" && i + 1 < argc) {
+            if (!has_l) {
+                node.event_log_path = argv[++i];
+                has_l = true;
+            } else {
+                ++i;
+            }
+        }
         else {
             std::cerr << "Error: unknown argument or missing value: " 
                       << arg << "\n";
@@ -135,248 +528,516 @@ bool parse_arguments(int argc, char* argv[]) {
 
 void print_usage() {
     std::cout << "Usage:\n"
-              << "  ./node [-b bind_address] [-p port] [-a peer_address -r peer_port]\n"
+              << "  ./node [-b bind_address] [-p port] [-a peer_address -r peer_port] [-t threads]\n"
+              << "         [-m mesh|tree] [-i delay_ms,jitter_ms,loss_percent] [-l event_log]\n"
+              << "         [-c peer_cache]\n"
               << "Options:\n"
-              << "  -b   IP address to listen on (default: 0.0.0.0)\n"
+              << "  -b   IPv4 or IPv6 address to listen on (default: 0.0.0.0, all addresses of both)\n"
               << "  -p   Port to listen on (0–65535, default: 0)\n"
               << "  -a   Address of another node to connect to\n"
-              << "  -r   Port of the peer node (1–65535)\n";
+              << "  -r   Port of the peer node (1–65535)\n"
+              << "  -t   Receiver threads sharing the port (1–" << MAX_THREADS << ", default: 1)\n"
+              << "  -m   Send SYNC_START to all peers (mesh, default) or along a tree\n"
+              << "  -i   Delay, jitter and drop sent datagrams, for testing\n"
+              << "  -l   Record sent and received datagrams and offset changes in a binary\n"
+              << "       event log, for ./event-decode\n"
+              << "  -c   Save the peers to a file and reconnect to them on start\n";
 }
 
-void log_error_message(const std::array<uint8_t, BUFFER_SIZE>& buffer, size_t received) {
+void log_error_message(ByteView datagram) {
     std::cerr << "ERROR MSG ";
-    size_t length_to_print = std::min<size_t>(10, received);
+    size_t length_to_print = std::min<size_t>(10, datagram.size);
     for (size_t i = 0; i < length_to_print; ++i) {
-        std::cerr << std::hex << static_cast<int>(buffer[i]);
+        std::cerr << std::hex << std::setw(2) << std::setfill('0')
+                  << static_cast<int>(datagram.data[i]);
     }
-    std::cerr << std::endl;
+    std::cerr << std::dec << std::setfill(' ') << std::endl;
 }
 
-int main(int argc, char* argv[]) {
-    if (!parse_arguments(argc, argv)) {
-        print_usage();
-        return 1;
+// Answers GET_TIME and DELAY_REQUEST from the published sync state, so that
+// any receiver thread can; returns false for other messages. The answer
+// goes out on `output`, a receiver thread's socket or the outbound queue.
+template <typename Output>
+bool answer_query(Output& output, ByteView datagram, const Peer& sender,
+                  std::chrono::time_point<std::chrono::steady_clock> now) {
+    switch (getMessageType(datagram)) {
+        case DELAY_REQUEST: {
+            SyncState state = node.snapshot.load();
+            DelayRequest delay_request;
+            if (state.sync_level == 255 || !decode(datagram, delay_request) ||
+                !node.known.contains(sender.address, sender.port)) {
+                log_error_message(datagram);
+                break;
+            }
+            // T4 is synchronized time, like T1 in our SYNC_START
+            DelayResponse delay_response{state.sync_level, state.time(natural_time(now), now)};
+            output.send_to(delay_response, sender);
+            break;
+        }
+        case GET_TIME: {
+            SyncState state = node.snapshot.load();
+            now = std::chrono::steady_clock::now();
+            int64_t time = state.time(natural_time(now), now);
+            GetTime get_time;
+            GetTimeExtended get_time_extended;
+            if (decode(datagram, get_time)) {
+                Time time_message{state.sync_level, time};
+                output.send_to(time_message, sender);
+            } else if (decode(datagram, get_time_extended) &&
+                       get_time_extended.flags == TIME_STATISTICS) {
+                TimeStatistics statistics;
+                statistics.synchronized = state.sync_level;
+                statistics.timestamp = time;
+                statistics.round_trip = state.round_trip;
+                statistics.dispersion = state.dispersion;
+                output.send_to(statistics, sender);
+            } else {
+                log_error_message(datagram);
+            }
+            break;
+        }
+        default:
+            return false;
     }
-    node.start_time = std::chrono::steady_clock::now();
-    node.curr_time_offset = 0;
-    
-    node.socket = UdpSocket(node.port, node.bind_address, 2, 0);
+    return true;
+}
 
-    if (node.connect_to_peer) {
-        connect_to_peer();
+// A valid DELAY_REQUEST in tree mode makes the sender our child, ranked
+// by how long after our SYNC_START it came
+void note_child(ByteView datagram, const Peer& sender,
+                std::chrono::time_point<std::chrono::steady_clock> now) {
+    DelayRequest delay_request;
+    if (node.sync_level == 255 || !decode(datagram, delay_request) ||
+        !node.peers.contains(sender.address, sender.port)) {
+        return;
     }
+    int64_t round_trip = -1;
+    if (now - node.last_sync_start < SYNC_INTERVAL) {
+        round_trip = std::chrono::duration_cast<std::chrono::milliseconds>(
+            now - node.last_sync_start).count();
+    }
+    node.children.note(sender, round_trip, now);
+}
 
-    auto last_message_time = std::chrono::steady_clock::now();
+// SYNC_START in tree mode: every parent gets its own exchange, so that we
+// know the round trip to each, but only the best one sets our clock
+void tree_sync_start(OutboundQueue& output, const SyncStart& sync_start, const Peer& sender,
+                     std::chrono::time_point<std::chrono::steady_clock> now) {
+    Parent* parent = node.parents.find(sender);
+    // Parents must be closer to the leader than we are
+    if (sync_start.synchronized >= node.sync_level) {
+        if (parent != nullptr)
+            lose_parent(sender);
+        return;
+    }
+    if (parent == nullptr)
+        parent = node.parents.offer(sender, sync_start.synchronized, now);
+    if (parent == nullptr)
+        return;
+    parent->level = sync_start.synchronized;
+    parent->heard = now;
+    if (node.synchronized_peer_ip == sender.address && node.synchronized_peer_port == sender.port)
+        mark_sync_alive();
 
-    while (true) {
-        auto now = std::chrono::steady_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - last_message_time).count();
-        
-        // Check if we haven't received a SYNC_START from our synchronized peer for too long (20-30 seconds)
-        if (node.sync_level < 255 && node.synchronized_peer_ip != 0) {
-            auto sync_elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - node.last_sync_time).count();
-            if (sync_elapsed > 20) { 
-                // We haven't received SYNC_START from our synchronized peer for too long
-                node.sync_level = 255;
-                node.synchronized_peer_ip = 0;
-                node.synchronized_peer_port = 0;
-                node.curr_time_offset = 0;
+    // T2 is when SYNC_START arrived, T3 is taken by stamp_datagram
+    parent->pending = true;
+    parent->t1 = sync_start.timestamp;
+    parent->t2 = natural_time(now);
+    DelayRequest delay_request;
+    output.send_to(delay_request, sender);
+}
+
+// DELAY_RESPONSE in tree mode; returns false if it wasn't expected
+bool tree_delay_response(const DelayResponse& delay_response, const Peer& sender,
+                         std::chrono::time_point<std::chrono::steady_clock> now) {
+    Parent* parent = node.parents.find(sender);
+    if (parent == nullptr || !parent->pending)
+        return false;
+    parent->pending = false;
+    int64_t t4 = delay_response.timestamp;
+    ClockSample sample;
+    sample.offset = (parent->t2 - parent->t1 + parent->t3 - t4) / 2;
+    sample.round_trip = (t4 - parent->t1) - (parent->t3 - parent->t2);
+    parent->round_trip = std::max<int64_t>(sample.round_trip, 0);
+    parent->level = delay_response.synchronized;
+
+    if (node.parents.best() != parent)
+        return true;
+    bool switched = node.synchronized_peer_ip != sender.address ||
+                    node.synchronized_peer_port != sender.port;
+    apply_sample(sample, sender, parent->level, now);
+    if (switched)
+        mark_sync_alive();
+    // Parents no closer to the leader than we are now would make a loop
+    node.parents.prune(now - SYNC_LOSS_TIMEOUT, node.sync_level);
+    return true;
+}
+
+// Handles one received message; `now` is the time it was received
+// Every message is decoded in place and rejected if its length doesn't match its type
+void handle_message(OutboundQueue& output, ByteView datagram, const Peer& sender,
+                    std::chrono::time_point<std::chrono::steady_clock> now) {
+    uint8_t message_type = getMessageType(datagram);
+    
+    switch (message_type) {
+        case HELLO: {
+            // A repeated HELLO (e.g. after a lost reply) gets the reply again,
+            // but the sender is added only once
+            Hello hello;
+            if (!decode(datagram, hello) ||
+                (!node.peers.contains(sender.address, sender.port) && node.peers.full())) {
+                log_error_message(datagram);
+                break;
             }
-        }
-        
-        if (elapsed > 5 && node.sync_level < 254) {
-            // send sync_start message every 5-10 seconds
-            // Calculate current time relative to start time plus any offset
-            int64_t current_time = std::chrono::duration_cast<std::chrono::milliseconds>(
-                now - node.start_time).count() - node.curr_time_offset;
-            
-            // Create SYNC_START message with node's sync level and current timestamp
-            SyncStart sync_start(node.sync_level, current_time);
-            
-            // Send SYNC_START to all known peers
-            for (uint16_t i = 0; i < node.peer_count; ++i) {
-                std::string peer_ip = inet_ntoa({node.peers[i].address});
-                node.socket.send_to(sync_start, peer_ip, node.peers[i].port);
+            // The reply is written straight from the peer table into the send buffer,
+            // cut short to the peers which fit if they don't all fit in one datagram
+            size_t size = encode_peer_list(HELLO_REPLY, node.peers.begin(), node.peers.size(), 0,
+                                           sender, output.send_buffer());
+            if (size == 0) {
+                size = encode_peer_list(HELLO_REPLY, node.peers.begin(), node.peers.size(), 0,
+                                        sender, output.send_buffer(), true);
             }
-            
-            last_message_time = now;
+            output.send_to(ByteSpan{output.send_buffer().data, size}, sender);
+            add_peer(sender);
+            break;
         }
-        std::string sender_ip;
-        uint16_t sender_port;
-        ssize_t received = node.socket.recv_from(sender_ip, sender_port);
-        now = std::chrono::steady_clock::now();
-        uint32_t sender_ip_num = inet_addr(sender_ip.c_str());
-        if constexpr (DEBUG) {
-            std::cout << "Node state:\n"
-                                << "  Sync Level: " << static_cast<int>(node.sync_level) << "\n"
-                                << "  Synchronized Peer IP: " << inet_ntoa({node.synchronized_peer_ip}) << "\n"
-                                << "  Synchronized Peer Port: " << node.synchronized_peer_port << "\n"
-                                << "  Synchronizing Peer IP: " << inet_ntoa({node.synchronizing_peer_ip}) << "\n"
-                                << "  Synchronizing Peer Port: " << node.synchronizing_peer_port << "\n"
-                                << "  Current Time Offset: " << node.curr_time_offset << "\n"
-                                << "  Next Time Offset: " << node.next_time_offset << "\n"
-                                << "  Peer Count: " << node.peer_count << "\n"
-                                << "  Last time synced: " << node.last_sync_time.time_since_epoch().count() << "\n"
-                                << "  Synced time: " << std::chrono::duration_cast<std::chrono::milliseconds>(now - node.start_time).count() - node.curr_time_offset << "\n";
-        }
-        if (received == 0) {
-            // This is a timeout, silently continue without logging an error
-            continue;
-        } else if (received < 0) {
-            // This shouldn't happen as exceptions should be thrown by recv_from for actual errors
-            log_error_message(node.socket.buffer, received);
-            continue;
-        }
-        
-        uint8_t message_type = getMessageType(node.socket.buffer);
-        
-        switch (message_type) {
-            case HELLO: {
-                HelloReply hello_reply(node.peer_count, node.peers);
-                node.socket.send_to(hello_reply, sender_ip, sender_port);
-                node.peers[node.peer_count++] = Peer(sender_ip, sender_port);
+        case HELLO_REPLY: {
+            if (!node.joining || sender != node.join_target) {
+                log_error_message(datagram);
                 break;
             }
-            case CONNECT: {
-                Connect connect(node.socket.buffer);
-                if (node.peer_count < MAX_PEERS) {
-                    node.peers[node.peer_count++] = Peer(sender_ip, sender_port);
-                    AckConnect ack_connect;
-                    node.socket.send_to(ack_connect, sender_ip, sender_port);
-                } else {
-                    log_error_message(node.socket.buffer, received);
-                }
+            PeerListView hello_reply;
+            if (!hello_reply.parse(datagram, HELLO_REPLY)) {
+                log_error_message(datagram);
                 break;
-            } 
-            case ACK_CONNECT: {
-                AckConnect ack_connect(node.socket.buffer);
-                auto it = std::find_if(node.unack_peers.begin(), node.unack_peers.end(), 
-                                       [&](const Peer& peer) {
-                                           return peer.address == sender_ip_num && peer.port == sender_port;
-                                       });
-
-                if (it != node.unack_peers.end() && node.peer_count < MAX_PEERS) {
-                    node.peers[node.peer_count++] = *it;
-                    node.unack_peers.erase(it);
-                } else {
-                    log_error_message(node.socket.buffer, received);
+            }
+            // The list must not include the sender
+            for (Peer peer : hello_reply) {
+                if (peer == sender) {
+                    log_error_message(datagram);
+                    return;
+                }
+            }
+            node.retries = 0;
+            add_peer(sender);
+
+            for (Peer peer : hello_reply) {
+                if (!node.unack_peers.insert(peer)) {
+                    continue;  // listed twice
                 }
+
+                Connect connect;
+                output.send_to(connect, peer);
+            }
+            // The reply holds at most a datagram of peers, so joining costs the same
+            // in any network: the peers not on it hear of us through the sender's
+            // gossip and connect
+            node.joining = false;
+            if (node.unack_peers.size() > 0) {
+                node.reactor.arm(node.retry_timer, RETRY_INTERVAL);
+            }
+            break;
+        }
+        case GOSSIP: {
+            PeerListView gossip;
+            if (!node.peers.contains(sender.address, sender.port) ||
+                !gossip.parse(datagram, GOSSIP)) {
+                log_error_message(datagram);
                 break;
             }
-            case SYNC_START: {
-                SyncStart sync_start(node.socket.buffer);
-                auto it = std::find_if(node.peers.begin(), node.peers.begin() + node.peer_count, 
-                                       [&](const Peer& peer) {
-                                           return peer.address == sender_ip_num && peer.port == sender_port;
-                                       });
-
-                if (it != node.peers.begin() + node.peer_count && sync_start.synchronized < 254) {
-                    // Check if this is our synchronized peer
-                    if (node.synchronized_peer_ip == sender_ip_num && 
-                        node.synchronized_peer_port == sender_port) {
-                        
-                        // Update the last sync time since we received a SYNC_START from our synchronized peer
-                        node.last_sync_time = std::chrono::steady_clock::now();
-                        
-                        // If synchronized peer's level is >= our level, set our sync_level to 255
-                        if (sync_start.synchronized >= node.sync_level) {
-                            node.sync_level = 255;
-                            node.synchronized_peer_ip = 0;
-                            node.synchronized_peer_port = 0;
-                            node.isSynchronizing = false;
-                        } else {
-                            node.synchronizing_peer_ip = sender_ip_num;
-                            node.synchronizing_peer_port = sender_port;
-                            node.isSynchronizing = true;
-                        }
-                    } else if (sync_start.synchronized < node.sync_level - 1) {
-                        // Synchronize with this peer as it has a lower sync level
-                        node.synchronizing_peer_ip = sender_ip_num;
-                        node.synchronizing_peer_port = sender_port;
-                        node.isSynchronizing = true;
-                        node.last_sync_time = std::chrono::steady_clock::now();
-                    }
-                    if (node.isSynchronizing) {
+            bool added = false;
+            for (Peer peer : gossip) {
+                if (node.peers.contains(peer.address, peer.port) || node.peers.full() ||
+                    !node.unack_peers.insert(peer)) {
+                    continue;
+                }
+                Connect connect;
+                output.send_to(connect, peer);
+                added = true;
+            }
+            if (added && !node.joining && !node.reactor.armed(node.retry_timer)) {
+                node.retries = 0;
+                node.reactor.arm(node.retry_timer, RETRY_INTERVAL);
+            }
+            break;
+        }
+        case CONNECT: {
+            Connect connect;
+            if (decode(datagram, connect) &&
+                (node.peers.contains(sender.address, sender.port) || add_peer(sender))) {
+                AckConnect ack_connect;
+                output.send_to(ack_connect, sender);
+            } else {
+                log_error_message(datagram);
+            }
+            break;
+        } 
+        case ACK_CONNECT: {
+            AckConnect ack_connect;
+            if (decode(datagram, ack_connect) && !node.peers.full() &&
+                node.unack_peers.erase(sender.address, sender.port)) {
+                add_peer(sender);
+                // In tree mode our parent from before the restart sends
+                // SYNC_START only to its children, which DELAY_REQUEST makes us
+                if (sender == node.restored_parent) {
+                    node.restored_parent = Peer();
+                    if (node.tree) {
                         DelayRequest delay_request;
-                        int64_t time_from_program_start = std::chrono::duration_cast<std::chrono::milliseconds>(
-                            now - node.start_time).count();
-                        node.next_time_offset = time_from_program_start - sync_start.timestamp + std::chrono::duration_cast<std::chrono::milliseconds>(now - node.start_time).count();
-                        node.socket.send_to(delay_request, sender_ip, sender_port);
+                        output.send_to(delay_request, sender);
                     }
+                }
+            } else {
+                log_error_message(datagram);
+            }
+            break;
+        }
+        case SYNC_START: {
+            SyncStart sync_start;
+            if (decode(datagram, sync_start) && node.peers.contains(sender.address, sender.port) &&
+                sync_start.synchronized < 254) {
+                if (node.tree) {
+                    tree_sync_start(output, sync_start, sender, now);
+                // Check if this is our synchronized peer
+                } else if (node.synchronized_peer_ip == sender.address && 
+                    node.synchronized_peer_port == sender.port) {
                     
-                } else {
-                    log_error_message(node.socket.buffer, received);
+                    // Update the last sync time since we received a SYNC_START from our synchronized peer
+                    mark_sync_alive();
+                    
+                    // If synchronized peer's level is >= our level, set our sync_level to 255
+                    if (sync_start.synchronized >= node.sync_level) {
+                        lose_sync();
+                        node.isSynchronizing = false;
+                    } else {
+                        node.synchronizing_peer_ip = sender.address;
+                        node.synchronizing_peer_port = sender.port;
+                        node.isSynchronizing = true;
+                    }
+                } else if (sync_start.synchronized < node.sync_level - 1) {
+                    // Synchronize with this peer as it has a lower sync level
+                    node.synchronizing_peer_ip = sender.address;
+                    node.synchronizing_peer_port = sender.port;
+                    node.isSynchronizing = true;
+                    mark_sync_alive();
+                }
+                if (node.isSynchronizing) {
+                    DelayRequest delay_request;
+                    // T2 is when SYNC_START arrived, T3 is taken by stamp_datagram
+                    node.t1 = sync_start.timestamp;
+                    node.t2 = natural_time(now);
+                    output.send_to(delay_request, sender);
                 }
                 
-                break;
+            } else {
+                log_error_message(datagram);
             }
-            case DELAY_REQUEST: {
-                if (node.sync_level == 255) {
-                    log_error_message(node.socket.buffer, received);
-                    break;
-                }
-                DelayRequest delay_request(node.socket.buffer);
-                auto it = std::find_if(node.peers.begin(), node.peers.begin() + node.peer_count, 
-                                       [&](const Peer& peer) {
-                                           return peer.address == sender_ip_num && peer.port == sender_port;
-                                       });
-                if (it != node.peers.begin() + node.peer_count) {
-                    int64_t time_from_program_start = std::chrono::duration_cast<std::chrono::milliseconds>(
-                        now - node.start_time).count();
-                    // Send DELAY_RESPONSE with our sync level and current timestamp
-                    DelayResponse delay_response(node.sync_level, time_from_program_start);
-                    node.socket.send_to(delay_response, sender_ip, sender_port);
-                } else {
-                    log_error_message(node.socket.buffer, received);
+            
+            break;
+        }
+        case DELAY_REQUEST:
+            answer_query(output, datagram, sender, now);
+            if (node.tree) {
+                note_child(datagram, sender, now);
+            }
+            break;
+        case GET_TIME:
+            answer_query(output, datagram, sender, now);
+            break;
+        case DELAY_RESPONSE: {
+            DelayResponse delay_response;
+            if (node.tree) {
+                if (!decode(datagram, delay_response) ||
+                    !tree_delay_response(delay_response, sender, now)) {
+                    log_error_message(datagram);
                 }
-                break;
+            } else if (decode(datagram, delay_response) && node.isSynchronizing &&
+                node.synchronizing_peer_ip == sender.address &&
+                node.synchronizing_peer_port == sender.port) {
+                    int64_t t4 = delay_response.timestamp;
+                    ClockSample sample;
+                    sample.offset = (node.t2 - node.t1 + node.t3 - t4) / 2;
+                    sample.round_trip = (t4 - node.t1) - (node.t3 - node.t2);
+                    node.isSynchronizing = false;
+                    apply_sample(sample, sender, delay_response.synchronized, now);
+            } else {
+                log_error_message(datagram);
             }
-            case DELAY_RESPONSE: {
-                DelayResponse delay_response(node.socket.buffer);
-                if (node.isSynchronizing &&
-                    node.synchronizing_peer_ip == sender_ip_num &&
-                    node.synchronizing_peer_port == sender_port) {
-                        node.next_time_offset -= delay_response.timestamp;
-                        node.curr_time_offset = node.next_time_offset/2;
-                        node.sync_level = delay_response.synchronized + 1;
-                        node.synchronized_peer_ip = sender_ip_num;
-                        node.synchronized_peer_port = sender_port;
-                        node.isSynchronizing = false;
-                } else {
-                    log_error_message(node.socket.buffer, received);
+            break;
+        }
+        case LEADER: {
+            Leader leader;
+            
+            if (!decode(datagram, leader)) {
+                log_error_message(datagram);
+            } else if (leader.synchronized == 0) {
+                node.sync_level = 0;
+                node.reactor.arm(node.sync_timer, LEADER_DELAY, SYNC_INTERVAL);
+                node.event_log.record(EventKind::LEVEL, node.sync_level, nullptr);
+                publish_sync();
+            } else if (leader.synchronized == 255 && node.sync_level == 0) {
+                node.sync_level = 255;
+                node.event_log.record(EventKind::LEVEL, node.sync_level, nullptr);
+                publish_sync();
+            } else {
+                log_error_message(datagram);
+            }
+
+            break;
+        }
+        default: {
+            log_error_message(datagram);
+            break;
+        }
+    }
+}
+
+// Receives on one of the SO_REUSEPORT sockets, answering GET_TIME and
+// DELAY_REQUEST itself and passing everything else to the reactor thread
+void run_receiver(UdpSocket socket) {
+    try {
+        while (true) {
+            size_t received = socket.recv_many();
+            for (size_t i = 0; i < received; ++i) {
+                Peer sender = socket.batch_sender(i);
+                ByteView datagram = socket.batch_datagram(i);
+                if (!answer_query(socket, datagram, sender, socket.batch_time(i))) {
+                    node.inbox.push(datagram, sender, socket.batch_time(i));
+                } else if (node.tree && getMessageType(datagram) == DELAY_REQUEST) {
+                    // Answered, but the children are kept by the reactor thread
+                    node.inbox.push(datagram, sender, socket.batch_time(i), true);
                 }
-                break;
             }
-            case LEADER: {
-                Leader leader(node.socket.buffer);
-                
-                if (leader.synchronized == 0) {
-                    node.sync_level = 0;
-                } else if (leader.synchronized == 255 && node.sync_level == 0) {
-                    node.sync_level = 255;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "ERROR " << e.what() << std::endl;
+        std::exit(1);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (!parse_arguments(argc, argv)) {
+        print_usage();
+        return 1;
+    }
+    node.start_time = std::chrono::steady_clock::now();
+
+    bool tracing = !node.event_log_path.empty();
+    bool caching = !node.peer_cache_path.empty();
+    int signal_fd = -1;
+    if (tracing || caching) {
+        // SIGINT and SIGTERM are blocked in every thread and taken by the
+        // reactor, so that the event log and the peer cache are written on exit
+        sigset_t stop_signals;
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGINT);
+        sigaddset(&stop_signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+        signal_fd = signalfd(-1, &stop_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (signal_fd < 0)
+            throw std::runtime_error("signalfd() failed");
+    }
+    if (tracing) {
+        node.event_log.open(node.event_log_path);
+    }
+
+    bool sharded = node.threads > 1;
+    node.socket = UdpSocket(node.port, node.bind_address, 0, 0, sharded);
+    node.socket.set_nonblocking();
+    // Without kernel timestamps T2 and T4 are taken when the datagram is read
+    node.socket.enable_timestamps();
+    if (node.impaired) {
+        node.socket.impair(node.impairment);
+    }
+    if (tracing) {
+        node.socket.trace(&node.event_log);
+    }
+
+    node.sync_timer = node.reactor.add_timer(on_sync_timer);
+    node.sync_loss_timer = node.reactor.add_timer(on_sync_loss);
+    node.retry_timer = node.reactor.add_timer(on_retry);
+    node.gossip_timer = node.reactor.add_timer(on_gossip);
+    node.reactor.arm(node.sync_timer, SYNC_INTERVAL, SYNC_INTERVAL);
+    node.reactor.arm(node.gossip_timer, GOSSIP_INTERVAL, GOSSIP_INTERVAL);
+    if (caching) {
+        node.cache_timer = node.reactor.add_timer(on_cache_timer);
+        node.reactor.arm(node.cache_timer, CACHE_INTERVAL, CACHE_INTERVAL);
+    }
+
+    node.reactor.watch(node.socket.get_fd(), [] {
+        size_t received = node.socket.recv_many();
+        auto now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < received; ++i) {
+            handle_message(node.outbound, node.socket.batch_datagram(i),
+                           node.socket.batch_sender(i), node.socket.batch_time(i));
+        }
+        if constexpr (DEBUG) {
+            std::cout << "Node state:\n"
+                                << "  Sync Level: " << static_cast<int>(node.sync_level) << "\n"
+                                << "  Synchronized Peer IP: " << format_address(node.synchronized_peer_ip) << "\n"
+                                << "  Synchronized Peer Port: " << node.synchronized_peer_port << "\n"
+                                << "  Synchronizing Peer IP: " << format_address(node.synchronizing_peer_ip) << "\n"
+                                << "  Synchronizing Peer Port: " << node.synchronizing_peer_port << "\n"
+                                << "  Current Time Offset: " << node.time_offset.at(now) << "\n"
+                                << "  Round Trip: " << (node.clock_filter.empty() ? 0 : node.clock_filter.best().round_trip) << "\n"
+                                << "  Dispersion: " << node.clock_filter.dispersion() << "\n"
+                                << "  Peer Count: " << node.peers.size() << "\n"
+                                << "  Last time synced: " << node.last_sync_time.time_since_epoch().count() << "\n"
+                                << "  Synced time: " << node_time(now) << "\n";
+        }
+    });
+
+    if (sharded) {
+        node.reactor.watch(node.inbox.get_fd(), [] {
+            node.inbox.take(node.forwarded);
+            for (const Inbox::Entry& entry : node.forwarded) {
+                ByteView datagram{entry.datagram.data(), entry.datagram.size()};
+                if (entry.answered) {
+                    note_child(datagram, entry.sender, entry.time);
                 } else {
-                    log_error_message(node.socket.buffer, received);
+                    handle_message(node.outbound, datagram, entry.sender, entry.time);
                 }
-
-                break;
             }
-            case GET_TIME: {
-                // Handle GET_TIME message
-                GetTime get_time(node.socket.buffer);
-                now = std::chrono::steady_clock::now();
-                int64_t time = std::chrono::duration_cast<std::chrono::milliseconds>(now - node.start_time).count();
-                if (node.sync_level < 255) {
-                    time -= node.curr_time_offset;
-                }
-                Time time_message(node.sync_level, time);
-                node.socket.send_to(time_message, sender_ip, sender_port);
-                break;
+        });
+        // The other sockets bind the port the first one got, also if it was 0
+        for (unsigned i = 1; i < node.threads; ++i) {
+            UdpSocket socket(node.socket.local_port(), node.bind_address, 0, 0, true);
+            socket.enable_timestamps();
+            if (node.impaired) {
+                socket.impair(node.impairment);
             }
-            default: {
-                log_error_message(node.socket.buffer, received);
-                break;
+            if (tracing) {
+                socket.trace(&node.event_log);
             }
+            std::thread(run_receiver, std::move(socket)).detach();
         }
     }
+
+    if (signal_fd >= 0) {
+        node.reactor.watch(signal_fd, [signal_fd] {
+            signalfd_siginfo info;
+            if (read(signal_fd, &info, sizeof(info)) != sizeof(info))
+                return;
+            if (!node.peer_cache_path.empty()) {
+                save_cache();
+            }
+            node.event_log.close();
+            // Then end the way the signal would have ended us
+            int signal_number = static_cast<int>(info.ssi_signo);
+            sigset_t signals;
+            sigemptyset(&signals);
+            sigaddset(&signals, signal_number);
+            std::signal(signal_number, SIG_DFL);
+            pthread_sigmask(SIG_UNBLOCK, &signals, nullptr);
+            std::raise(signal_number);
+        });
+    }
+
+    // With cached peers, -a is only used if none of them answers
+    bool restored = caching && restore_peers();
+    if (node.connect_to_peer && !restored) {
+        connect_to_peer();
+    }
+
+    node.reactor.run();
     return 0;
 }
\ No newline at end of file
@@ -1,20 +1,28 @@
 #ifndef MESSAGE_HPP
 #define MESSAGE_HPP
 
-#include <cinttypes>
-#include <ctime>
-#include <vector>
+#include <algorithm>
 #include <array>
+#include <cinttypes>
+#include <cstddef>
+#include <cstring>
 #include <iostream>
+#include <string>
+#include <arpa/inet.h>
 
-#ifndef NDEBUG
+// Printing every datagram and the node state, for debugging; off in
+// builds with NDEBUG, such as the Makefile's
+#ifdef NDEBUG
     constexpr bool DEBUG = false;
 #else
     constexpr bool DEBUG = true;
 #endif
 
 constexpr uint8_t ADDRESS_LENGTH = 4;
+constexpr uint8_t IPV6_ADDRESS_LENGTH = 16;
 constexpr size_t BUFFER_SIZE = 65536;
+// Largest UDP payload over IPv4, which is below the IPv6 one
+constexpr size_t MAX_DATAGRAM = 65507;
 constexpr size_t MAX_PEERS = 65536;
 
 // message types
@@ -22,6 +30,7 @@ constexpr uint8_t HELLO = 1;
 constexpr uint8_t HELLO_REPLY = 2;
 constexpr uint8_t CONNECT = 3;
 constexpr uint8_t ACK_CONNECT = 4;
+constexpr uint8_t GOSSIP = 6;
 constexpr uint8_t SYNC_START = 11;
 constexpr uint8_t DELAY_REQUEST = 12;
 constexpr uint8_t DELAY_RESPONSE = 13;
@@ -29,325 +38,441 @@ constexpr uint8_t LEADER = 21;
 constexpr uint8_t GET_TIME = 31;
 constexpr uint8_t TIME = 32;
 
-inline uint8_t getMessageType(std::array<uint8_t, BUFFER_SIZE>& buffer) {
-    return buffer[0];
+// IPv6 address in network byte order. IPv4 addresses are kept IPv4-mapped
+// (::ffff:a.b.c.d), the way a dual-stack socket reports IPv4 senders.
+using Address = std::array<uint8_t, IPV6_ADDRESS_LENGTH>;
+
+constexpr size_t IPV4_MAPPED_PREFIX = IPV6_ADDRESS_LENGTH - ADDRESS_LENGTH;
+
+// address is an IPv4 address in network byte order
+inline Address map_ipv4(uint32_t address) {
+    Address mapped{};
+    mapped[10] = 0xff;
+    mapped[11] = 0xff;
+    memcpy(mapped.data() + IPV4_MAPPED_PREFIX, &address, ADDRESS_LENGTH);
+    return mapped;
 }
 
-struct Message {
-    uint8_t type;
-    Message() = default;
-    Message(uint8_t type) : type(type) {}
-    virtual size_t serialize(std::array<uint8_t, BUFFER_SIZE>& buffer) {
-        buffer[0] = type;
-        return 1;
+inline bool is_ipv4(const Address& address) {
+    for (size_t i = 0; i < IPV4_MAPPED_PREFIX - 2; ++i) {
+        if (address[i] != 0)
+            return false;
     }
-    virtual void deserialize(const std::array<uint8_t, BUFFER_SIZE>& buffer) {
-        type = buffer[0];
-    }
-    
-    // Debug printing function that will be overridden by derived classes
-    virtual void debug_print(const std::string& direction, const std::string& ip, uint16_t port) const {
-        if constexpr (DEBUG) {
-            std::string msg_type = get_message_type_name();
-            std::cout << direction << " basic message: " << msg_type 
-                      << " (type=" << static_cast<int>(type) << ")"
-                      << " with " << ip << ":" << port << std::endl;
-        }
+    return address[10] == 0xff && address[11] == 0xff;
+}
+
+// Parses a numeric address of either family, returns false if it is neither
+inline bool parse_address(const std::string& text, Address& address) {
+    uint32_t ipv4;
+    if (inet_pton(AF_INET, text.c_str(), &ipv4) == 1) {
+        address = map_ipv4(ipv4);
+        return true;
+    }
+    return inet_pton(AF_INET6, text.c_str(), address.data()) == 1;
+}
+
+// struct for peer information
+struct Peer {
+    Address address{};
+    uint16_t port = 0;
+    Peer() = default;
+    Peer(const Address& address, uint16_t port) :
+            address(address), port(port) {}
+    // A numeric address of either family; the unspecified address if it isn't one
+    Peer(std::string address, uint16_t port) : port(port) {
+        if (!parse_address(address, this->address))
+            this->address = Address{};
     }
-    
-    // Helper to get message type name
-    std::string get_message_type_name() const {
-        switch (type) {
-            case HELLO: return "HELLO";
-            case HELLO_REPLY: return "HELLO_REPLY";
-            case CONNECT: return "CONNECT";
-            case ACK_CONNECT: return "ACK_CONNECT";
-            case SYNC_START: return "SYNC_START";
-            case DELAY_REQUEST: return "DELAY_REQUEST";
-            case DELAY_RESPONSE: return "DELAY_RESPONSE";
-            case LEADER: return "LEADER";
-            case GET_TIME: return "GET_TIME";
-            case TIME: return "TIME";
-            default: return "UNKNOWN";
-        }
+
+    bool operator==(const Peer& other) const {
+        return address == other.address && port == other.port;
     }
+    bool operator!=(const Peer& other) const { return !(*this == other); }
+};
+
+// The codec never allocates - it reads from and writes into buffers owned
+// by the caller, through these views of their bytes
+struct ByteView {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+struct ByteSpan {
+    uint8_t* data = nullptr;
+    size_t size = 0;
 };
 
+inline uint8_t getMessageType(ByteView datagram) {
+    return datagram.size > 0 ? datagram.data[0] : 0;
+}
 
-// --------------------------messages with only type---------------------------
+// All multi-octet fields are in network byte order
+inline void put_u16(uint8_t* out, uint16_t value) {
+    out[0] = static_cast<uint8_t>(value >> 8);
+    out[1] = static_cast<uint8_t>(value);
+}
 
+inline uint16_t get_u16(const uint8_t* in) {
+    return static_cast<uint16_t>((in[0] << 8) | in[1]);
+}
 
-// ale w sumie to mozna by zrobic funkcje ktora tworzy odpowiedni typ wiadmosci na podstawie parametru)
-struct Hello : public Message {
-    Hello() : Message(HELLO) {}
-    Hello(std::array<uint8_t, BUFFER_SIZE>& buffer) {
-        deserialize(buffer);
+inline void put_u32(uint8_t* out, uint32_t value) {
+    for (size_t i = 0; i < sizeof(value); ++i) {
+        out[i] = static_cast<uint8_t>(value >> ((sizeof(value) - 1 - i) * 8));
     }
-    
-    void debug_print(const std::string& direction, const std::string& ip, uint16_t port) const override {
-        if constexpr (DEBUG) {
-            std::cout << direction << " HELLO message (type=" << static_cast<int>(type) 
-                      << ") with " << ip << ":" << port << std::endl;
-        }
+}
+
+inline uint32_t get_u32(const uint8_t* in) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < sizeof(value); ++i) {
+        value = (value << 8) | in[i];
     }
-};
+    return value;
+}
 
-struct Connect : public Message {
-    Connect() : Message(CONNECT) {}
-    Connect(std::array<uint8_t, BUFFER_SIZE>& buffer) {
-        deserialize(buffer);
+inline void put_i64(uint8_t* out, int64_t value) {
+    uint64_t bits = static_cast<uint64_t>(value);
+    for (size_t i = 0; i < sizeof(bits); ++i) {
+        out[i] = static_cast<uint8_t>(bits >> ((sizeof(bits) - 1 - i) * 8));
     }
-    
-    void debug_print(const std::string& direction, const std::string& ip, uint16_t port) const override {
-        if constexpr (DEBUG) {
-            std::cout << direction << " CONNECT message (type=" << static_cast<int>(type) 
-                      << ") with " << ip << ":" << port << std::endl;
-        }
+}
+
+inline int64_t get_i64(const uint8_t* in) {
+    uint64_t bits = 0;
+    for (size_t i = 0; i < sizeof(bits); ++i) {
+        bits = (bits << 8) | in[i];
     }
+    return static_cast<int64_t>(bits);
+}
+
+
+// --------------------------fixed layout messages-----------------------------
+
+// Every fixed layout message is a plain struct with its TYPE and SIZE
+// (including the type octet); encode_body writes the fields after the type
+// octet and decode_body reads them back.
+
+template <uint8_t Type>
+struct TypeOnlyMessage {
+    static constexpr uint8_t TYPE = Type;
+    static constexpr size_t SIZE = 1;
+    void encode_body(uint8_t*) const {}
+    void decode_body(const uint8_t*) {}
 };
 
-struct AckConnect : public Message {
-    AckConnect() : Message(ACK_CONNECT) {}
-    AckConnect(std::array<uint8_t, BUFFER_SIZE>& buffer) {
-        deserialize(buffer);
-    }
-    
-    void debug_print(const std::string& direction, const std::string& ip, uint16_t port) const override {
-        if constexpr (DEBUG) {
-            std::cout << direction << " ACK_CONNECT message (type=" << static_cast<int>(type) 
-                      << ") with " << ip << ":" << port << std::endl;
-        }
+using Hello = TypeOnlyMessage<HELLO>;
+using Connect = TypeOnlyMessage<CONNECT>;
+using AckConnect = TypeOnlyMessage<ACK_CONNECT>;
+using DelayRequest = TypeOnlyMessage<DELAY_REQUEST>;
+using GetTime = TypeOnlyMessage<GET_TIME>;
+
+template <uint8_t Type>
+struct TimeStampMessage {
+    static constexpr uint8_t TYPE = Type;
+    static constexpr size_t SIZE = 1 + 1 + 8;
+    uint8_t synchronized = 0;
+    int64_t timestamp = 0;
+    void encode_body(uint8_t* out) const {
+        out[0] = synchronized;
+        put_i64(out + 1, timestamp);
+    }
+    void decode_body(const uint8_t* in) {
+        synchronized = in[0];
+        timestamp = get_i64(in + 1);
     }
 };
 
-struct DelayRequest : public Message {
-    DelayRequest() : Message(DELAY_REQUEST) {}
-    DelayRequest(std::array<uint8_t, BUFFER_SIZE>& buffer) {
-        deserialize(buffer);
+using SyncStart = TimeStampMessage<SYNC_START>;
+using DelayResponse = TimeStampMessage<DELAY_RESPONSE>;
+using Time = TimeStampMessage<TIME>;
+
+// GET_TIME with a flags octet; with TIME_STATISTICS set it is answered
+// with TimeStatistics instead of TIME, for monitoring the sync quality
+constexpr uint8_t TIME_STATISTICS = 1;
+
+struct GetTimeExtended {
+    static constexpr uint8_t TYPE = GET_TIME;
+    static constexpr size_t SIZE = 2;
+    uint8_t flags = 0;
+    void encode_body(uint8_t* out) const {
+        out[0] = flags;
     }
-    
-    void debug_print(const std::string& direction, const std::string& ip, uint16_t port) const override {
-        if constexpr (DEBUG) {
-            std::cout << direction << " DELAY_REQUEST message (type=" << static_cast<int>(type) 
-                      << ") with " << ip << ":" << port << std::endl;
-        }
+    void decode_body(const uint8_t* in) {
+        flags = in[0];
     }
 };
 
-struct GetTime : public Message {
-    GetTime() : Message(GET_TIME) {}
-    GetTime(std::array<uint8_t, BUFFER_SIZE>& buffer) {
-        deserialize(buffer);
-    }
-    
-    void debug_print(const std::string& direction, const std::string& ip, uint16_t port) const override {
-        if constexpr (DEBUG) {
-            std::cout << direction << " GET_TIME message (type=" << static_cast<int>(type) 
-                      << ") with " << ip << ":" << port << std::endl;
-        }
+// TIME followed by the round trip to the synchronized peer and the
+// dispersion of the offset samples, both in milliseconds (0 if unsynchronized)
+struct TimeStatistics {
+    static constexpr uint8_t TYPE = TIME;
+    static constexpr size_t SIZE = Time::SIZE + 4 + 4;
+    uint8_t synchronized = 0;
+    int64_t timestamp = 0;
+    uint32_t round_trip = 0;
+    uint32_t dispersion = 0;
+    void encode_body(uint8_t* out) const {
+        out[0] = synchronized;
+        put_i64(out + 1, timestamp);
+        put_u32(out + 9, round_trip);
+        put_u32(out + 13, dispersion);
+    }
+    void decode_body(const uint8_t* in) {
+        synchronized = in[0];
+        timestamp = get_i64(in + 1);
+        round_trip = get_u32(in + 9);
+        dispersion = get_u32(in + 13);
     }
 };
 
+// Where TimeStampMessage and TimeStatistics carry the timestamp
+constexpr size_t TIMESTAMP_OFFSET = 2;
 
-// --------------------------messages with timestamp---------------------------
-
-struct TimeStampMessage : public Message {
-    uint8_t synchronized;
-    int64_t timestamp;
-    TimeStampMessage() = default;
-    TimeStampMessage(uint8_t type, uint8_t synchronized, int64_t timestamp) : 
-            Message(type), synchronized(synchronized), timestamp(timestamp) {}
-    virtual size_t serialize(std::array<uint8_t, BUFFER_SIZE>& buffer) override {
-        buffer[0] = type;
-        buffer[1] = synchronized;
-        for (size_t i = 0; i < sizeof(timestamp); ++i) {
-            buffer[i + 2] = static_cast<uint8_t>((timestamp >> (i * 8)) & 0xFF);
-        }
-        return sizeof(timestamp) + 2;
-    }
-    virtual void deserialize(const std::array<uint8_t, BUFFER_SIZE>& buffer) override {
-        type = buffer[0];
-        synchronized = buffer[1];
-        timestamp = 0;
-        for (size_t i = 0; i < sizeof(timestamp); ++i) {
-            timestamp |= static_cast<int64_t>(buffer[i + 2]) << (i * 8);
-        }
+struct Leader {
+    static constexpr uint8_t TYPE = LEADER;
+    static constexpr size_t SIZE = 2;
+    uint8_t synchronized = 0;
+    void encode_body(uint8_t* out) const {
+        out[0] = synchronized;
     }
-    
-    // Override debug_print to include timestamp and sync level
-    virtual void debug_print(const std::string& direction, const std::string& ip, uint16_t port) const override {
-        if constexpr (DEBUG) {
-            std::string msg_type = get_message_type_name();
-            std::cout << direction << " message type: " << msg_type 
-                      << " (" << static_cast<int>(type) << ")"
-                      << " with " << ip << ":" << port
-                      << " | sync_level: " << static_cast<int>(synchronized)
-                      << " | timestamp: " << timestamp << std::endl;
-        }
+    void decode_body(const uint8_t* in) {
+        synchronized = in[0];
     }
 };
 
-struct SyncStart : public TimeStampMessage {
-    SyncStart(uint8_t synchronized, int64_t timestamp) : 
-            TimeStampMessage(SYNC_START, synchronized, timestamp) {}
-    SyncStart(std::array<uint8_t, BUFFER_SIZE>& buffer) {
-        deserialize(buffer);
-    }
-    
-    void debug_print(const std::string& direction, const std::string& ip, uint16_t port) const override {
-        if constexpr (DEBUG) {
-            std::cout << direction << " SYNC_START message (type=" << static_cast<int>(type) 
-                      << ") with " << ip << ":" << port
-                      << " | sync_level=" << static_cast<int>(synchronized)
-                      << " | timestamp=" << timestamp << std::endl;
+// Writes the message at the beginning of out, returns its size
+// or 0 if it doesn't fit
+template <typename M>
+size_t encode(const M& message, ByteSpan out) {
+    if (out.size < M::SIZE)
+        return 0;
+    out.data[0] = M::TYPE;
+    message.encode_body(out.data + 1);
+    return M::SIZE;
+}
+
+// Returns false if the datagram isn't exactly a message of this type
+template <typename M>
+bool decode(ByteView in, M& message) {
+    if (in.size != M::SIZE || in.data[0] != M::TYPE)
+        return false;
+    message.decode_body(in.data + 1);
+    return true;
+}
+
+
+//---------------------------peer lists---------------------------------------
+
+// HELLO_REPLY and GOSSIP share one layout: a count and that many peer records.
+// A record holds an IPv4 address (ADDRESS_LENGTH octets) or an IPv6 one
+// (IPV6_ADDRESS_LENGTH octets), as given by its length octet.
+// A HELLO_REPLY too large for one datagram is cut short to its first page,
+// the peers which fit: that is all a joining node uses, the others hear of
+// it through gossip.
+
+constexpr size_t HELLO_REPLY_HEADER_SIZE = 3;
+constexpr size_t PEER_RECORD_SIZE = 1 + ADDRESS_LENGTH + 2;
+constexpr size_t IPV6_PEER_RECORD_SIZE = 1 + IPV6_ADDRESS_LENGTH + 2;
+
+// IPv4 peers go out with 4-octet addresses, which every node understands
+inline size_t peer_record_size(const Peer& peer) {
+    return is_ipv4(peer.address) ? PEER_RECORD_SIZE : IPV6_PEER_RECORD_SIZE;
+}
+
+inline size_t encode_peer(uint8_t* out, const Peer& peer) {
+    uint8_t length = is_ipv4(peer.address) ? ADDRESS_LENGTH : IPV6_ADDRESS_LENGTH;
+    out[0] = length;
+    memcpy(out + 1, peer.address.data() + IPV6_ADDRESS_LENGTH - length, length);
+    put_u16(out + 1 + length, peer.port);
+    return 1 + length + 2;
+}
+
+// Reads the peer record at the beginning of in, returns its size or 0 if
+// it is truncated or invalid
+inline size_t decode_peer(ByteView in, Peer& peer) {
+    if (in.size == 0)
+        return 0;
+    size_t length = in.data[0];
+    if ((length != ADDRESS_LENGTH && length != IPV6_ADDRESS_LENGTH) || in.size < 1 + length + 2)
+        return 0;
+    if (length == ADDRESS_LENGTH) {
+        uint32_t ipv4;
+        memcpy(&ipv4, in.data + 1, ADDRESS_LENGTH);
+        peer.address = map_ipv4(ipv4);
+    } else {
+        memcpy(peer.address.data(), in.data + 1, IPV6_ADDRESS_LENGTH);
+    }
+    peer.port = get_u16(in.data + 1 + length);
+    return peer.port != 0 ? 1 + length + 2 : 0;
+}
+
+// Writes a peer list of the given type with peers[from, count) except
+// `except` (the receiver), straight from the peer table without copying
+// them first. Returns its size, or 0 if it doesn't fit in out or in the
+// count field. If truncate, it instead stops at the first peer which doesn't fit.
+inline size_t encode_peer_list(uint8_t type, const Peer* peers, size_t count, size_t from,
+                               const Peer& except, ByteSpan out, bool truncate = false) {
+    if (out.size < HELLO_REPLY_HEADER_SIZE)
+        return 0;
+    size_t offset = HELLO_REPLY_HEADER_SIZE;
+    size_t records = 0;
+    for (size_t i = from; i < count; ++i) {
+        const Peer& peer = peers[i];
+        if (peer == except)
+            continue;
+        if (offset + peer_record_size(peer) > out.size || records == UINT16_MAX) {
+            if (!truncate)
+                return 0;
+            break;
         }
+        offset += encode_peer(out.data + offset, peer);
+        ++records;
     }
-};
+    out.data[0] = type;
+    put_u16(out.data + 1, static_cast<uint16_t>(records));
+    return offset;
+}
 
-struct DelayResponse : public TimeStampMessage {
-    DelayResponse(uint8_t synchronized, int64_t timestamp) : 
-            TimeStampMessage(DELAY_RESPONSE, synchronized, timestamp) {}
-    DelayResponse(std::array<uint8_t, BUFFER_SIZE>& buffer) {
-        deserialize(buffer);
-    }
-    
-    void debug_print(const std::string& direction, const std::string& ip, uint16_t port) const override {
-        if constexpr (DEBUG) {
-            std::cout << direction << " DELAY_RESPONSE message (type=" << static_cast<int>(type) 
-                      << ") with " << ip << ":" << port
-                      << " | sync_level=" << static_cast<int>(synchronized)
-                      << " | timestamp=" << timestamp << std::endl;
+// A received peer list, validated and then read in place. Records differ
+// in size, so they are read in order, by iterating over the list.
+class PeerListView {
+public:
+    class Iterator {
+    public:
+        explicit Iterator(const uint8_t* record) : record(record) {}
+        Peer operator*() const {
+            // Validated by parse, so any record fits
+            Peer peer;
+            decode_peer(ByteView{record, IPV6_PEER_RECORD_SIZE}, peer);
+            return peer;
         }
-    }
-};
+        Iterator& operator++() {
+            record += 1 + record[0] + 2;
+            return *this;
+        }
+        bool operator!=(const Iterator& other) const { return record != other.record; }
 
-struct Time : public TimeStampMessage {
-    Time(uint8_t synchronized, int64_t timestamp) : 
-            TimeStampMessage(TIME, synchronized, timestamp) {}
-    Time(std::array<uint8_t, BUFFER_SIZE>& buffer) {
-        deserialize(buffer);
-    }
-    
-    void debug_print(const std::string& direction, const std::string& ip, uint16_t port) const override {
-        if constexpr (DEBUG) {
-            std::cout << direction << " TIME message (type=" << static_cast<int>(type) 
-                      << ") with " << ip << ":" << port
-                      << " | sync_level=" << static_cast<int>(synchronized)
-                      << " | timestamp=" << timestamp << std::endl;
+    private:
+        const uint8_t* record;
+    };
+
+    // Returns false if the datagram isn't of this type or doesn't hold
+    // exactly `count` valid records
+    bool parse(ByteView in, uint8_t type) {
+        if (in.size < HELLO_REPLY_HEADER_SIZE || in.data[0] != type)
+            return false;
+        size_t records = get_u16(in.data + 1);
+        size_t end = HELLO_REPLY_HEADER_SIZE;
+        for (size_t i = 0; i < records; ++i) {
+            Peer peer;
+            size_t size = decode_peer(ByteView{in.data + end, in.size - end}, peer);
+            if (size == 0)
+                return false;
+            end += size;
         }
+        if (in.size != end)
+            return false;
+        data = in;
+        count = records;
+        records_end = end;
+        return true;
     }
-};
 
+    size_t size() const { return count; }
 
-//---------------------------other messages------------------------------------
+    Iterator begin() const { return Iterator(data.data + HELLO_REPLY_HEADER_SIZE); }
+    Iterator end() const { return Iterator(data.data + records_end); }
 
-// struct for peer information
-struct Peer {
-    uint32_t address;
-    uint16_t port;
-    Peer() : address(0), port(0) {}
-    Peer(uint32_t address, uint16_t port) : 
-            address(address), port(port) {}
-    Peer(std::string address, uint16_t port) : 
-            address(inet_addr(address.c_str())), port(port) {}
+private:
+    ByteView data;
+    size_t count = 0;
+    size_t records_end = 0;
 };
 
-struct HelloReply : public Message {
-    std::vector<Peer> peers;
-    HelloReply(uint16_t peer_count, std::array<Peer, MAX_PEERS>& peers) : Message(HELLO_REPLY) {
-        this->peers.reserve(peer_count);
-        for (uint16_t i = 0; i < peer_count; ++i) {
-            this->peers.emplace_back(peers[i]);
-        }
-    }
-    HelloReply(std::array<uint8_t, BUFFER_SIZE>& buffer) {
-        deserialize(buffer);
+
+//---------------------------debug printing-----------------------------------
+
+// Address of a peer, only for logging; IPv4-mapped ones as dotted quads
+inline std::string format_address(const Address& address) {
+    char ip_buf[INET6_ADDRSTRLEN];
+    if (is_ipv4(address))
+        inet_ntop(AF_INET, address.data() + IPV4_MAPPED_PREFIX, ip_buf, sizeof(ip_buf));
+    else
+        inet_ntop(AF_INET6, address.data(), ip_buf, sizeof(ip_buf));
+    return ip_buf;
+}
+
+inline const char* get_message_type_name(uint8_t type) {
+    switch (type) {
+        case HELLO: return "HELLO";
+        case HELLO_REPLY: return "HELLO_REPLY";
+        case CONNECT: return "CONNECT";
+        case ACK_CONNECT: return "ACK_CONNECT";
+        case GOSSIP: return "GOSSIP";
+        case SYNC_START: return "SYNC_START";
+        case DELAY_REQUEST: return "DELAY_REQUEST";
+        case DELAY_RESPONSE: return "DELAY_RESPONSE";
+        case LEADER: return "LEADER";
+        case GET_TIME: return "GET_TIME";
+        case TIME: return "TIME";
+        default: return "UNKNOWN";
     }
-    size_t serialize(std::array<uint8_t, BUFFER_SIZE>& buffer) override {
-        uint16_t count = peers.size();
-        buffer[0] = type;
-        
-        buffer[1] = static_cast<uint8_t>((count >> 8) & 0xFF);
-        buffer[2] = static_cast<uint8_t>(count & 0xFF);
-        size_t offset = 3;
-        
-        for (uint16_t i = 0; i < count && i < peers.size(); ++i) {
-            const auto& peer = peers[i];
-            buffer[offset++] = ADDRESS_LENGTH;
-            for (size_t j = 0; j < ADDRESS_LENGTH; ++j) {
-                buffer[offset++] = static_cast<uint8_t>((peer.address >> (j * 8)) & 0xFF);
-            }
-            buffer[offset++] = static_cast<uint8_t>((peer.port >> 8) & 0xFF);
-            buffer[offset++] = static_cast<uint8_t>(peer.port & 0xFF);
-        }
-        return offset;
+}
+
+template <typename M>
+void debug_print_timestamped(ByteView datagram) {
+    M message;
+    if (decode(datagram, message)) {
+        std::cout << " | sync_level=" << static_cast<int>(message.synchronized)
+                  << " | timestamp=" << message.timestamp;
     }
-    void deserialize(const std::array<uint8_t, BUFFER_SIZE>& buffer) override {
-        type = buffer[0];
-        uint16_t count = (static_cast<uint16_t>(buffer[1]) << 8) | static_cast<uint16_t>(buffer[2]);
-        size_t offset = 3;
-        for (size_t i = 0; i < count; ++i) {
-            uint8_t received_address_length = buffer[offset++];
-            if (received_address_length != ADDRESS_LENGTH) {
-                std::cerr << "ERROR MSG ";
-                for (size_t k = 0; k < 10 && k < BUFFER_SIZE; ++k) {
-                    std::cerr << std::hex << static_cast<int>(buffer[k]) << " ";
+}
+
+// Prints a sent or received datagram with its fields
+inline void debug_print_message(const std::string& direction, ByteView datagram,
+                                const std::string& ip, uint16_t port) {
+    if constexpr (DEBUG) {
+        uint8_t type = getMessageType(datagram);
+        std::cout << direction << " " << get_message_type_name(type) << " message (type="
+                  << static_cast<int>(type) << ") with " << ip << ":" << port;
+        switch (type) {
+            case SYNC_START: debug_print_timestamped<SyncStart>(datagram); break;
+            case DELAY_RESPONSE: debug_print_timestamped<DelayResponse>(datagram); break;
+            case TIME: {
+                TimeStatistics statistics;
+                if (decode(datagram, statistics)) {
+                    debug_print_timestamped<TimeStatistics>(datagram);
+                    std::cout << " | round_trip=" << statistics.round_trip
+                              << " | dispersion=" << statistics.dispersion;
+                } else {
+                    debug_print_timestamped<Time>(datagram);
                 }
+                break;
             }
-            
-            // Convert 4 bytes to a uint32_t address
-            uint32_t address = 0;
-            for (size_t j = 0; j < ADDRESS_LENGTH; ++j) {
-                address |= static_cast<uint32_t>(buffer[offset++]) << (j * 8);
+            case LEADER: {
+                Leader leader;
+                if (decode(datagram, leader))
+                    std::cout << " | sync_level=" << static_cast<int>(leader.synchronized);
+                break;
             }
-            
-            uint16_t port = (static_cast<uint16_t>(buffer[offset]) << 8) | static_cast<uint16_t>(buffer[offset + 1]);
-            offset += 2;
-            
-            peers.emplace_back(address, port);
-        }
-    }
-    
-    void debug_print(const std::string& direction, const std::string& ip, uint16_t port) const override {
-        if constexpr (DEBUG) {
-            std::cout << direction << " HELLO_REPLY message (type=" << static_cast<int>(type) 
-                      << ") with " << ip << ":" << port
-                      << " | peer_count=" << peers.size() << std::endl;
-            
-            // Print details of each peer in the reply
-            for (size_t i = 0; i < peers.size(); i++) {
-                char peer_ip[INET_ADDRSTRLEN];
-                inet_ntop(AF_INET, &peers[i].address, peer_ip, sizeof(peer_ip));
-                std::cout << "   Peer " << i << ": " << peer_ip << ":" << peers[i].port << std::endl;
+            case HELLO_REPLY:
+            case GOSSIP: {
+                PeerListView reply;
+                if (reply.parse(datagram, type)) {
+                    std::cout << " | peer_count=" << reply.size();
+                    // Print details of each peer in the reply
+                    size_t i = 0;
+                    for (Peer peer : reply) {
+                        std::cout << "\n   Peer " << i++ << ": " << format_address(peer.address)
+                                  << ":" << peer.port;
+                    }
+                }
+                break;
             }
+            default: break;
         }
+        std::cout << std::endl;
     }
-};
-
-struct Leader : public Message {
-    uint8_t synchronized;
-    Leader(uint8_t synchronized) : Message(LEADER), 
-            synchronized(synchronized) {}
-    Leader(std::array<uint8_t, BUFFER_SIZE>& buffer) {
-        deserialize(buffer);
-    }
-    size_t serialize(std::array<uint8_t, BUFFER_SIZE>& buffer) override {
-        buffer[0] = type;
-        buffer[1] = synchronized;
-        return 2;
-    }
-    void deserialize(const std::array<uint8_t, BUFFER_SIZE>& buffer) override {
-        type = buffer[0];
-        synchronized = buffer[1];
-    }
-    
-    void debug_print(const std::string& direction, const std::string& ip, uint16_t port) const override {
-        if constexpr (DEBUG) {
-            std::cout << direction << " LEADER message (type=" << static_cast<int>(type) 
-                      << ") with " << ip << ":" << port
-                      << " | sync_level=" << static_cast<int>(synchronized) << std::endl;
-        }
-    }
-}; 
+}
 
-#endif // MESSAGE_HPP
\ No newline at end of file
+#endif // MESSAGE_HPP
@@ -1,50 +1,61 @@
 #include "network.hpp"
 #include <iostream>
 #include <netdb.h>  // For getaddrinfo
+#include <algorithm>
+#include <fcntl.h>
 
 // Debug constant reference
 
 UdpSocket::UdpSocket(uint16_t port, const std::string& bind_address, 
-                     uint64_t timeout_seconds, uint64_t timeout_microseconds) {
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+                     uint64_t timeout_seconds, uint64_t timeout_microseconds,
+                     bool reuse_port) {
+    Peer local = resolve(bind_address, port);
+    bool wildcard = local.address == Address{} || local.address == map_ipv4(INADDR_ANY);
+    // Only a wildcard address can be dual-stack; an IPv4 one gets an IPv4 socket
+    family = !wildcard && is_ipv4(local.address) ? AF_INET : AF_INET6;
+    sockfd = socket(family, SOCK_DGRAM, 0);
+    if (sockfd < 0 && errno == EAFNOSUPPORT && wildcard) {
+        family = AF_INET;
+        sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    }
     if (sockfd < 0)
         throw std::runtime_error("socket() failed");
+    dual_stack = wildcard && family == AF_INET6;
 
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    
-    // Try first with inet_pton (IP address)
-    if (inet_pton(AF_INET, bind_address.c_str(), &addr.sin_addr) <= 0) {
-        // If inet_pton fails, try to resolve as a hostname
-        struct addrinfo hints, *res;
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_DGRAM;
-        
-        int status = getaddrinfo(bind_address.c_str(), nullptr, &hints, &res);
-        if (status != 0)
-            throw std::runtime_error("Cannot resolve bind address: " + std::string(gai_strerror(status)));
-        
-        // Copy the resolved address
-        addr.sin_addr = ((struct sockaddr_in*)res->ai_addr)->sin_addr;
-        freeaddrinfo(res);
-    }
+    int disable = 0;
+    if (dual_stack && setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &disable, sizeof(disable)) < 0)
+        throw std::runtime_error("setsockopt(IPV6_V6ONLY) failed");
+
+    if (wildcard)
+        local.address = family == AF_INET6 ? Address{} : map_ipv4(INADDR_ANY);
+    SocketAddress addr;
+    socklen_t addr_length = to_sockaddr(local, family, addr);
+
+    int enable = 1;
+    if (reuse_port && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0)
+        throw std::runtime_error("setsockopt(SO_REUSEPORT) failed");
 
-    if (bind(sockfd, (sockaddr*)&addr, sizeof(addr)) < 0)
+    if (bind(sockfd, &addr.any, addr_length) < 0)
         throw std::runtime_error("bind() failed");
 
     set_timeout(timeout_seconds, timeout_microseconds);
+    batch_buffers.resize(RECV_BATCH);
 }
 
 UdpSocket::~UdpSocket() {
+    // Stops sending before the descriptor is closed
+    delay_line.reset();
     if (sockfd >= 0)
         close(sockfd);
 }
 
 // Move constructor - correctly ordered initialization
 UdpSocket::UdpSocket(UdpSocket&& other) noexcept 
-    : buffer(std::move(other.buffer)), sockfd(other.sockfd), addr(other.addr) {
+    : buffer(std::move(other.buffer)), sockfd(other.sockfd), family(other.family), dual_stack(other.dual_stack),
+      batch_buffers(std::move(other.batch_buffers)), batch_lengths(other.batch_lengths),
+      batch_senders(other.batch_senders), batch_times(other.batch_times),
+      timestamps(other.timestamps), delay_line(std::move(other.delay_line)),
+      event_log(other.event_log) {
     // Take ownership of the descriptor and set the source object to -1,
     // so that the destructor doesn't close the socket
     other.sockfd = -1;
@@ -53,6 +64,7 @@ UdpSocket::UdpSocket(UdpSocket&& other) noexcept
 UdpSocket& UdpSocket::operator=(UdpSocket&& other) noexcept {
     if (this != &other) {
         // Close the previous socket if it was open
+        delay_line.reset();
         if (sockfd >= 0) {
             close(sockfd);
         }
@@ -60,7 +72,15 @@ UdpSocket& UdpSocket::operator=(UdpSocket&& other) noexcept {
         // Take ownership of resources in the same order as in the constructor
         buffer = std::move(other.buffer);
         sockfd = other.sockfd;
-        addr = other.addr;
+        family = other.family;
+        dual_stack = other.dual_stack;
+        batch_buffers = std::move(other.batch_buffers);
+        batch_lengths = other.batch_lengths;
+        batch_senders = other.batch_senders;
+        batch_times = other.batch_times;
+        timestamps = other.timestamps;
+        delay_line = std::move(other.delay_line);
+        event_log = other.event_log;
         
         // Reset the source object
         other.sockfd = -1;
@@ -68,50 +88,41 @@ UdpSocket& UdpSocket::operator=(UdpSocket&& other) noexcept {
     return *this;
 }
 
-void send_to_common(Message& message, sockaddr_in& dest, int sockfd, std::array<uint8_t, BUFFER_SIZE>& buffer) {
-    size_t message_size = message.serialize(buffer);
-    
-    // Debug print for sending messages
-    if constexpr (DEBUG) {
-        char ip_buf[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &dest.sin_addr, ip_buf, sizeof(ip_buf));
-        std::string ip_str(ip_buf);
-        uint16_t port_num = ntohs(dest.sin_port);
-        message.debug_print("Sending", ip_str, port_num);
-    }
-    
-    ssize_t sent = sendto(sockfd, buffer.data(), message_size, 0,
-                          (sockaddr*)&dest, sizeof(dest));
+bool UdpSocket::send_to(ByteView datagram, const Peer& peer) {
+    SocketAddress dest;
+    socklen_t dest_length = destination(peer, dest);
 
-    if (sent < 0)
-        throw std::runtime_error("sendto() failed");
-}
+    // A peer of the other family is as good as lost
+    if (dest_length == 0)
+        return true;
 
-void UdpSocket::send_to(Message& message, const std::string& ip, uint16_t port) {
-    sockaddr_in dest = make_sockaddr(ip, port);
-
-    send_to_common(message, dest, sockfd, buffer);
-}
+    auto time = std::chrono::steady_clock::now();
+    if (delay_line) {
+        note_sent(datagram, peer, time);
+        delay_line->send(datagram, &dest.any, dest_length);
+        return true;
+    }
 
-void UdpSocket::send_to(Message& message, const uint32_t& ip, uint16_t port) {
-    sockaddr_in dest;
-    memset(&dest, 0, sizeof(dest));
-    dest.sin_family = AF_INET;
-    dest.sin_port = htons(port);
-    dest.sin_addr.s_addr = htonl(ip);
+    ssize_t sent = sendto(sockfd, datagram.data, datagram.size, 0, &dest.any, dest_length);
 
-    send_to_common(message, dest, sockfd, buffer);
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return false;
+    if (sent < 0 && !unroutable(errno))
+        throw std::runtime_error("sendto() failed: " + std::string(strerror(errno)));
+    if (sent >= 0)
+        note_sent(datagram, peer, time);
+    return true;
 }
 
-ssize_t UdpSocket::recv_from(std::string& sender_ip, uint16_t& sender_port) {
+ssize_t UdpSocket::recv_from(Peer& sender_peer) {
     if (sockfd < 0) {
         throw std::runtime_error("Socket is not initialized or already closed");
     }
-    sockaddr_in sender;
+    SocketAddress sender;
     socklen_t sender_len = sizeof(sender);
 
     ssize_t received = recvfrom(sockfd, buffer.data(), BUFFER_SIZE, 0,
-                                (sockaddr*)&sender, &sender_len);
+                                &sender.any, &sender_len);
 
     if (received < 0) {
         // Check if this is a timeout
@@ -126,84 +137,187 @@ ssize_t UdpSocket::recv_from(std::string& sender_ip, uint16_t& sender_port) {
         }
     }
 
-    char ip_buf[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &sender.sin_addr, ip_buf, sizeof(ip_buf));
-    sender_ip = ip_buf;
-    sender_port = ntohs(sender.sin_port);
-    
+    sender_peer = to_peer(sender);
+    if (event_log) {
+        event_log->record(EventKind::RECEIVED,
+                          getMessageType(ByteView{buffer.data(), static_cast<size_t>(received)}),
+                          &sender_peer, received);
+    }
+
     // Debug printing for received messages
     if constexpr (DEBUG) {
-        if (received < 1) {
-            std::cerr << "Received empty message from " << sender_ip << ":" << sender_port << std::endl;
+        debug_print_message("Received", ByteView{buffer.data(), static_cast<size_t>(received)},
+                            format_address(sender_peer.address), sender_peer.port);
+    }
+
+    return received;
+}
+
+size_t UdpSocket::send_many(ByteView datagram, const Peer* peers, size_t count) {
+    // Every datagram carries the same payload, encoded once
+    return send_batch(&datagram, true, peers, count);
+}
+
+size_t UdpSocket::send_each(const ByteView* datagrams, const Peer* peers, size_t count) {
+    return send_batch(datagrams, false, peers, count);
+}
+
+size_t UdpSocket::send_batch(const ByteView* datagrams, bool same, const Peer* peers, size_t count) {
+    if (delay_line) {
+        for (size_t i = 0; i < count; ++i)
+            send_to(datagrams[same ? 0 : i], peers[i]);
+        return count;
+    }
+
+    std::array<SocketAddress, SEND_BATCH> destinations;
+    std::array<iovec, SEND_BATCH> iovs;
+    std::array<mmsghdr, SEND_BATCH> headers;
+    std::array<size_t, SEND_BATCH> origins;  // the index of the peer of each header
+    size_t next = 0;
+    while (next < count) {
+        size_t batch = 0;
+        for (; next < count && batch < SEND_BATCH; ++next) {
+            SocketAddress& dest = destinations[batch];
+            socklen_t dest_length = destination(peers[next], dest);
+            if (dest_length == 0)
+                continue;  // of the other family
+
+            const ByteView& datagram = datagrams[same ? 0 : next];
+            iovs[batch] = {const_cast<uint8_t*>(datagram.data), datagram.size};
+            mmsghdr& header = headers[batch];
+            memset(&header, 0, sizeof(mmsghdr));
+            header.msg_hdr.msg_name = &dest;
+            header.msg_hdr.msg_namelen = dest_length;
+            header.msg_hdr.msg_iov = &iovs[batch];
+            header.msg_hdr.msg_iovlen = 1;
+            origins[batch++] = next;
         }
-        uint8_t message_type = buffer[0];
-        
-        // Create a temporary message object of the appropriate type to print debug info
-        switch(message_type) {
-            case HELLO: {
-                Hello msg(buffer);
-                msg.debug_print("Received", sender_ip, sender_port);
-                break;
-            }
-            case HELLO_REPLY: {
-                HelloReply msg(buffer);
-                msg.debug_print("Received", sender_ip, sender_port);
-                break;
-            }
-            case CONNECT: {
-                Connect msg(buffer);
-                msg.debug_print("Received", sender_ip, sender_port);
-                break;
-            }
-            case ACK_CONNECT: {
-                AckConnect msg(buffer);
-                msg.debug_print("Received", sender_ip, sender_port);
-                break;
-            }
-            case SYNC_START: {
-                SyncStart msg(buffer);
-                msg.debug_print("Received", sender_ip, sender_port);
-                break;
-            }
-            case DELAY_REQUEST: {
-                DelayRequest msg(buffer);
-                msg.debug_print("Received", sender_ip, sender_port);
-                break;
-            }
-            case DELAY_RESPONSE: {
-                DelayResponse msg(buffer);
-                msg.debug_print("Received", sender_ip, sender_port);
-                break;
-            }
-            case LEADER: {
-                Leader msg(buffer);
-                msg.debug_print("Received", sender_ip, sender_port);
-                break;
-            }
-            case GET_TIME: {
-                GetTime msg(buffer);
-                msg.debug_print("Received", sender_ip, sender_port);
-                break;
+
+        // sendmmsg may stop early, e.g. when the socket buffer is full,
+        // so we continue from the first datagram that wasn't sent
+        size_t done = 0;
+        while (done < batch) {
+            auto time = std::chrono::steady_clock::now();
+            int sent = sendmmsg(sockfd, headers.data() + done, batch - done, 0);
+            if (sent < 0 && unroutable(errno)) {
+                ++done;  // the first one failed, skip it
+                continue;
             }
-            case TIME: {
-                Time msg(buffer);
-                msg.debug_print("Received", sender_ip, sender_port);
-                break;
+            // Full: the rest is for the caller to send later
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return origins[done];
+            if (sent < 0)
+                throw std::runtime_error("sendmmsg() failed: " + std::string(strerror(errno)));
+            for (int i = 0; i < sent; ++i, ++done) {
+                size_t origin = origins[done];
+                note_sent(datagrams[same ? 0 : origin], peers[origin], time);
             }
-            default: {
-                std::cout << "Received unknown message type: " << static_cast<int>(message_type) 
-                          << " from " << sender_ip << ":" << sender_port << std::endl;
+        }
+    }
+    return count;
+}
+
+size_t UdpSocket::recv_many() {
+    if (sockfd < 0) {
+        throw std::runtime_error("Socket is not initialized or already closed");
+    }
+    std::array<iovec, RECV_BATCH> iovs;
+    std::array<mmsghdr, RECV_BATCH> headers;
+    for (size_t i = 0; i < RECV_BATCH; ++i) {
+        iovs[i] = {batch_buffers[i].data(), BUFFER_SIZE};
+        memset(&headers[i], 0, sizeof(mmsghdr));
+        headers[i].msg_hdr.msg_name = &batch_senders[i];
+        headers[i].msg_hdr.msg_namelen = sizeof(SocketAddress);
+        headers[i].msg_hdr.msg_iov = &iovs[i];
+        headers[i].msg_hdr.msg_iovlen = 1;
+        if (timestamps) {
+            headers[i].msg_hdr.msg_control = batch_controls[i].data();
+            headers[i].msg_hdr.msg_controllen = batch_controls[i].size();
+        }
+    }
+
+    // MSG_WAITFORONE - block (with SO_RCVTIMEO) until the first datagram,
+    // then take only what is already queued
+    int received = recvmmsg(sockfd, headers.data(), RECV_BATCH, MSG_WAITFORONE, nullptr);
+    if (received < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if constexpr (DEBUG) {
+                std::cout << "Socket timeout occurred" << std::endl;
             }
+            return 0;
         }
+        throw std::runtime_error("recvmmsg() failed: " + std::string(strerror(errno)));
     }
 
+    // Kernel timestamps are CLOCK_REALTIME, so they are turned into steady
+    // clock time points through how long ago they were taken
+    auto steady_now = std::chrono::steady_clock::now();
+    timespec real_now;
+    clock_gettime(CLOCK_REALTIME, &real_now);
+
+    for (int i = 0; i < received; ++i) {
+        batch_lengths[i] = headers[i].msg_len;
+        batch_times[i] = steady_now;
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&headers[i].msg_hdr); timestamps && cmsg != nullptr;
+             cmsg = CMSG_NXTHDR(&headers[i].msg_hdr, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPNS)
+                continue;
+            timespec stamp;
+            memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+            auto age = std::chrono::seconds(real_now.tv_sec - stamp.tv_sec) +
+                       std::chrono::nanoseconds(real_now.tv_nsec - stamp.tv_nsec);
+            // A negative age means the wall clock was stepped in between
+            if (age.count() >= 0) {
+                batch_times[i] = steady_now - std::chrono::duration_cast<std::chrono::steady_clock::duration>(age);
+            }
+        }
+        if (event_log) {
+            Peer sender = batch_sender(i);
+            event_log->record(EventKind::RECEIVED, getMessageType(batch_datagram(i)), &sender,
+                              static_cast<int64_t>(batch_lengths[i]), 0, batch_times[i]);
+        }
+        if constexpr (DEBUG) {
+            Peer sender = batch_sender(i);
+            debug_print_message("Received", batch_datagram(i), format_address(sender.address),
+                                sender.port);
+        }
+    }
     return received;
 }
 
+void UdpSocket::note_sent(ByteView datagram, const Peer& peer,
+                          std::chrono::steady_clock::time_point time) {
+    if (event_log) {
+        event_log->record(EventKind::SENT, getMessageType(datagram), &peer,
+                          static_cast<int64_t>(datagram.size), 0, time);
+    }
+    if constexpr (DEBUG) {
+        debug_print_message("Sending", datagram, format_address(peer.address), peer.port);
+    }
+}
+
+socklen_t UdpSocket::destination(const Peer& peer, SocketAddress& sa) const {
+    if (is_ipv4(peer.address) && family == AF_INET6 && !dual_stack)
+        return 0;
+    return to_sockaddr(peer, family, sa);
+}
+
+bool UdpSocket::unroutable(int error) {
+    return error == ENETUNREACH || error == EHOSTUNREACH || error == EAFNOSUPPORT;
+}
+
 int UdpSocket::get_fd() const {
     return sockfd;
 }
 
+uint16_t UdpSocket::local_port() const {
+    SocketAddress bound;
+    socklen_t length = sizeof(bound);
+    if (getsockname(sockfd, &bound.any, &length) < 0)
+        throw std::runtime_error("getsockname() failed");
+    return to_peer(bound).port;
+}
+
 void UdpSocket::set_timeout(uint64_t seconds, uint64_t microseconds) {
     timeval timeout;
     timeout.tv_sec = seconds;
@@ -213,28 +327,51 @@ void UdpSocket::set_timeout(uint64_t seconds, uint64_t microseconds) {
         throw std::runtime_error("setsockopt(SO_RCVTIMEO) failed");
 }
 
-sockaddr_in UdpSocket::make_sockaddr(const std::string& ip, uint16_t port) {
-    sockaddr_in sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sin_family = AF_INET;
-    sa.sin_port = htons(port);
-    
-    // Try first with inet_pton (IP address)
-    if (inet_pton(AF_INET, ip.c_str(), &sa.sin_addr) <= 0) {
-        // If inet_pton fails, try to resolve as a hostname
-        struct addrinfo hints, *res;
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_DGRAM;
-        
-        int status = getaddrinfo(ip.c_str(), nullptr, &hints, &res);
-        if (status != 0)
-            throw std::runtime_error("Cannot resolve destination address: " + std::string(gai_strerror(status)));
-        
-        // Copy the resolved address
-        sa.sin_addr = ((struct sockaddr_in*)res->ai_addr)->sin_addr;
-        freeaddrinfo(res);
+void UdpSocket::set_nonblocking() {
+    int flags = fcntl(sockfd, F_GETFL, 0);
+    if (flags < 0 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0)
+        throw std::runtime_error("fcntl(O_NONBLOCK) failed");
+}
+
+bool UdpSocket::enable_timestamps() {
+    int enable = 1;
+    timestamps = setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) == 0;
+    return timestamps;
+}
+
+void UdpSocket::impair(const Impairment& impairment) {
+    delay_line = std::make_unique<DelayLine>(sockfd, impairment);
+}
+
+Peer UdpSocket::resolve(const std::string& ip, uint16_t port) {
+    // Try first as a numeric address of either family
+    Address address;
+    if (parse_address(ip, address))
+        return Peer(address, port);
+
+    // If that fails, try to resolve as a hostname
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    int status = getaddrinfo(ip.c_str(), nullptr, &hints, &res);
+    if (status != 0)
+        throw std::runtime_error("Cannot resolve address " + ip + ": " + std::string(gai_strerror(status)));
+
+    const addrinfo* chosen = res;
+    for (const addrinfo* candidate = res; candidate != nullptr; candidate = candidate->ai_next) {
+        if (candidate->ai_family == AF_INET) {
+            chosen = candidate;
+            break;
+        }
     }
+    SocketAddress sa;
+    memset(&sa, 0, sizeof(sa));
+    memcpy(&sa, chosen->ai_addr, std::min<size_t>(chosen->ai_addrlen, sizeof(sa)));
+    freeaddrinfo(res);
 
-    return sa;
+    Peer peer = to_peer(sa);
+    peer.port = port;
+    return peer;
 }
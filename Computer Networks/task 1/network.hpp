@@ -9,33 +9,153 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <array>
+#include <vector>
+#include <chrono>
+#include <memory>
 
+#include "delay_line.hpp"
+#include "event_log.hpp"
 #include "message.hpp"
 
+// Maximum number of datagrams received with one recvmmsg call
+constexpr size_t RECV_BATCH = 32;
+// Maximum number of datagrams sent with one sendmmsg call
+constexpr size_t SEND_BATCH = 1024;
+
+// A socket address of either family, as the kernel reads and writes it
+union SocketAddress {
+    sockaddr any;
+    sockaddr_in v4;
+    sockaddr_in6 v6;
+};
+
+// Conversions between peers (port in host byte order) and socket addresses
+// of the given family, without going through strings. Returns the length
+// of the socket address, 0 if an AF_INET socket can't reach the peer.
+inline socklen_t to_sockaddr(const Peer& peer, int family, SocketAddress& sa) {
+    memset(&sa, 0, sizeof(sa));
+    if (family == AF_INET6) {
+        sa.v6.sin6_family = AF_INET6;
+        sa.v6.sin6_port = htons(peer.port);
+        memcpy(&sa.v6.sin6_addr, peer.address.data(), IPV6_ADDRESS_LENGTH);
+        return sizeof(sa.v6);
+    }
+    if (!is_ipv4(peer.address))
+        return 0;
+    sa.v4.sin_family = AF_INET;
+    sa.v4.sin_port = htons(peer.port);
+    memcpy(&sa.v4.sin_addr, peer.address.data() + IPV4_MAPPED_PREFIX, ADDRESS_LENGTH);
+    return sizeof(sa.v4);
+}
+
+inline Peer to_peer(const SocketAddress& sa) {
+    if (sa.any.sa_family == AF_INET6) {
+        Peer peer;
+        memcpy(peer.address.data(), &sa.v6.sin6_addr, IPV6_ADDRESS_LENGTH);
+        peer.port = ntohs(sa.v6.sin6_port);
+        return peer;
+    }
+    return Peer(map_ipv4(sa.v4.sin_addr.s_addr), ntohs(sa.v4.sin_port));
+}
+
+// Bound to a wildcard address, 0.0.0.0 or ::, the socket is dual-stack:
+// AF_INET6 with IPV6_V6ONLY off, so that it talks to IPv4 peers too, through
+// IPv4-mapped addresses (AF_INET if the kernel has no IPv6). Bound to
+// a specific address, it only talks to peers of that family. Datagrams to
+// peers it can't reach, or which have no route, are dropped like lost ones.
 class UdpSocket {
 public:
+    // With reuse_port, several sockets can bind the same address and port
+    // (SO_REUSEPORT); the kernel spreads senders among them
     UdpSocket(uint16_t port = 0, const std::string& bind_address = "0.0.0.0", 
-              uint64_t timeout_seconds = 2, uint64_t timeout_microseconds = 0);
+              uint64_t timeout_seconds = 2, uint64_t timeout_microseconds = 0,
+              bool reuse_port = false);
     ~UdpSocket();
     UdpSocket(const UdpSocket& other) = delete;  // Zablokuj kopiowanie
     UdpSocket& operator=(const UdpSocket& other) = delete;
     UdpSocket(UdpSocket&& other) noexcept;
     UdpSocket& operator=(UdpSocket&& other) noexcept;
-    void send_to(Message& message, const std::string& ip, uint16_t port);
-    void send_to(Message& message, const uint32_t& ip, uint16_t port);
-    ssize_t recv_from(std::string& sender_ip, uint16_t& sender_port);
+
+    // Encodes the message into the send buffer and sends it
+    template <typename M>
+    bool send_to(const M& message, const Peer& peer) {
+        return send_to(ByteView{buffer.data(), encode(message, send_buffer())}, peer);
+    }
+    // Sends a datagram already encoded, e.g. into send_buffer(). Returns
+    // false, without sending it, if a nonblocking socket's buffer is full.
+    bool send_to(ByteView datagram, const Peer& peer);
+    // Receives one datagram into buffer
+    ssize_t recv_from(Peer& sender);
+
+    // Sends the same message to all given peers with as few sendmmsg calls as
+    // possible. Returns the number of peers handled before a nonblocking
+    // socket's buffer filled up, all of them if it didn't.
+    template <typename M>
+    size_t send_many(const M& message, const Peer* peers, size_t count) {
+        return send_many(ByteView{buffer.data(), encode(message, send_buffer())}, peers, count);
+    }
+    size_t send_many(ByteView datagram, const Peer* peers, size_t count);
+    // Sends datagrams[i] to peers[i], otherwise like send_many
+    size_t send_each(const ByteView* datagrams, const Peer* peers, size_t count);
+    // Receives up to RECV_BATCH datagrams with one recvmmsg call, waiting
+    // (up to the timeout) only for the first one. Returns their number,
+    // 0 on timeout. They are available through batch_datagram and
+    // batch_sender until the next call.
+    size_t recv_many();
+    // When the datagram was received - the kernel timestamp if timestamps
+    // are enabled and the kernel provided one, or else when recv_many returned
+    std::chrono::steady_clock::time_point batch_time(size_t i) const { return batch_times[i]; }
+    ByteView batch_datagram(size_t i) const { return {batch_buffers[i].data(), batch_lengths[i]}; }
+    Peer batch_sender(size_t i) const { return to_peer(batch_senders[i]); }
     
     std::array<uint8_t, BUFFER_SIZE> buffer;  // Buffer is now a member variable
+    // The part of buffer a datagram can be encoded into
+    ByteSpan send_buffer() { return {buffer.data(), MAX_DATAGRAM}; }
 
     int get_fd() const;
+    // The port the socket is bound to, also when it was created with port 0
+    uint16_t local_port() const;
 
     void set_timeout(uint64_t seconds = 0, uint64_t microseconds = 0);
+    // For use with a Reactor - receiving returns 0 instead of blocking
+    void set_nonblocking();
+    // Asks the kernel to timestamp received datagrams (SO_TIMESTAMPNS),
+    // returns false if it isn't supported
+    bool enable_timestamps();
+
+    // Sends everything through a DelayLine from now on, for testing
+    void impair(const Impairment& impairment);
+    // Records every datagram sent and received in the log from now on
+    void trace(EventLog* log) { event_log = log; }
+
+    // Resolves an address or a host name once, so that the result can be
+    // used on the binary paths. A host name with addresses of both families
+    // resolves to the IPv4 one, which also works without IPv6.
+    static Peer resolve(const std::string& ip, uint16_t port);
 
 private:
     int sockfd;
-    sockaddr_in addr;
+    int family;
+    bool dual_stack;
+
+    // Storage for recv_many
+    std::vector<std::array<uint8_t, BUFFER_SIZE>> batch_buffers;
+    std::array<size_t, RECV_BATCH> batch_lengths;
+    std::array<SocketAddress, RECV_BATCH> batch_senders;
+    std::array<std::chrono::steady_clock::time_point, RECV_BATCH> batch_times;
+    std::array<std::array<uint8_t, CMSG_SPACE(sizeof(timespec))>, RECV_BATCH> batch_controls;
+    bool timestamps = false;
+    std::unique_ptr<DelayLine> delay_line;  // only when impaired
+    EventLog* event_log = nullptr;          // only when traced
 
-    sockaddr_in make_sockaddr(const std::string& ip, uint16_t port);
+    // send_many and send_each; datagrams has one element if `same` is set
+    size_t send_batch(const ByteView* datagrams, bool same, const Peer* peers, size_t count);
+    // Traces a datagram the kernel took; `time` is taken before the send,
+    // so that it can't come after the receive time of an answer
+    void note_sent(ByteView datagram, const Peer& peer, std::chrono::steady_clock::time_point time);
+    // The socket address to send to the peer, of length 0 if it is unreachable
+    socklen_t destination(const Peer& peer, SocketAddress& sa) const;
+    static bool unroutable(int error);
 };
 
 
@@ -0,0 +1,114 @@
+#include "outbound_queue.hpp"
+
+#include <algorithm>
+
+// Peers with a bucket, beyond which the full ones are forgotten
+constexpr size_t MAX_BUCKETS = 2 * MAX_PEERS;
+
+void OutboundQueue::send_to(ByteSpan datagram, const Peer& peer) {
+    send_many(datagram, &peer, 1);
+}
+
+void OutboundQueue::send_many(ByteSpan datagram, const Peer* peers, size_t count) {
+    auto now = Clock::now();
+    // Only membership messages are limited per peer, TIME only waits behind SYNC
+    if (get_priority(getMessageType(ByteView{datagram.data, datagram.size})) != Priority::MEMBERSHIP) {
+        send_now(datagram, peers, count, now);
+        return;
+    }
+    // Runs of peers with a token left go out together
+    size_t start = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (take_token(peers[i], now))
+            continue;
+        send_now(datagram, peers + start, i - start, now);
+        start = i + 1;
+    }
+    send_now(datagram, peers + start, count - start, now);
+}
+
+void OutboundQueue::send_now(ByteSpan datagram, const Peer* peers, size_t count,
+                             Clock::time_point now) {
+    if (count == 0)
+        return;
+    // Sending now would overtake what is waiting
+    size_t sent = 0;
+    if (!waiting) {
+        for (size_t i = 0; i < count; ++i)
+            stamp(datagram, peers[i], now);
+        sent = socket.send_many(ByteView{datagram.data, datagram.size}, peers, count);
+    }
+    if (sent < count)
+        enqueue(ByteView{datagram.data, datagram.size}, peers + sent, count - sent);
+}
+
+void OutboundQueue::enqueue(ByteView datagram, const Peer* peers, size_t count) {
+    auto& queue = queues[static_cast<size_t>(get_priority(getMessageType(datagram)))];
+    auto copy = std::make_shared<std::vector<uint8_t>>(datagram.data, datagram.data + datagram.size);
+    for (size_t i = 0; i < count && queue.size() < MAX_QUEUED; ++i)
+        queue.push_back(Entry{copy, peers[i]});
+    wait();
+}
+
+void OutboundQueue::wait() {
+    if (waiting)
+        return;
+    waiting = true;
+    reactor.wait_writable(socket.get_fd(), [this] { flush(); });
+}
+
+bool OutboundQueue::take_token(const Peer& peer, Clock::time_point now) {
+    auto it = buckets.find(peer);
+    if (it == buckets.end()) {
+        if (buckets.size() >= MAX_BUCKETS) {
+            // A full bucket is the same as none
+            for (auto bucket = buckets.begin(); bucket != buckets.end();) {
+                double idle = std::chrono::duration<double>(now - bucket->second.refilled).count();
+                if (bucket->second.tokens + idle * MEMBERSHIP_RATE >= MEMBERSHIP_BURST)
+                    bucket = buckets.erase(bucket);
+                else
+                    ++bucket;
+            }
+            if (buckets.size() >= MAX_BUCKETS)
+                buckets.clear();
+        }
+        it = buckets.emplace(peer, Bucket{MEMBERSHIP_BURST, now}).first;
+    }
+    Bucket& bucket = it->second;
+    double elapsed = std::chrono::duration<double>(now - bucket.refilled).count();
+    bucket.tokens = std::min(MEMBERSHIP_BURST, bucket.tokens + elapsed * MEMBERSHIP_RATE);
+    bucket.refilled = now;
+    if (bucket.tokens < 1)
+        return false;
+    bucket.tokens -= 1;
+    return true;
+}
+
+void OutboundQueue::flush() {
+    waiting = false;
+    while (size() > 0) {
+        // Stamped for this sendmmsg, not for when they were queued
+        auto now = Clock::now();
+        size_t batch = 0;
+        for (auto& queue : queues) {
+            for (size_t i = 0; i < queue.size() && batch < SEND_BATCH; ++i, ++batch) {
+                Entry& entry = queue[i];
+                ByteSpan datagram{entry.datagram->data(), entry.datagram->size()};
+                stamp(datagram, entry.peer, now);
+                batch_datagrams[batch] = ByteView{datagram.data, datagram.size};
+                batch_peers[batch] = entry.peer;
+            }
+        }
+        size_t sent = socket.send_each(batch_datagrams.data(), batch_peers.data(), batch);
+        size_t left = sent;
+        for (auto& queue : queues) {
+            size_t taken = std::min(left, queue.size());
+            queue.erase(queue.begin(), queue.begin() + taken);
+            left -= taken;
+        }
+        if (sent < batch) {
+            wait();
+            return;
+        }
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef OUTBOUND_QUEUE_HPP
+#define OUTBOUND_QUEUE_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "message.hpp"
+#include "network.hpp"
+#include "peer_table.hpp"
+#include "reactor.hpp"
+
+// SYNC_START, DELAY_REQUEST and DELAY_RESPONSE carry or measure time between
+// peers, so they go first whenever datagrams have to wait. TIME carries time
+// too, but answers GET_TIME from anyone, so it has a queue of its own after
+// them: a flood of GET_TIME can only fill (and overflow) that one.
+enum class Priority : uint8_t { SYNC = 0, TIME = 1, MEMBERSHIP = 2 };
+constexpr size_t PRIORITY_COUNT = 3;
+
+inline Priority get_priority(uint8_t message_type) {
+    switch (message_type) {
+        case SYNC_START:
+        case DELAY_REQUEST:
+        case DELAY_RESPONSE:
+            return Priority::SYNC;
+        case TIME:
+            return Priority::TIME;
+        default:
+            return Priority::MEMBERSHIP;
+    }
+}
+
+// Everything the reactor thread sends goes through here. Datagrams are
+// sent right away while the socket takes them; once its buffer is full
+// (EAGAIN) they wait, by priority, until the reactor sees it writable.
+// Membership messages are also limited per peer by a token bucket, so that
+// a burst of HELLO or CONNECT from one peer can't crowd out the rest; those
+// over the limit are dropped, and retransmitted like lost ones.
+class OutboundQueue {
+public:
+    using Clock = std::chrono::steady_clock;
+    // Writes the send time into a datagram which carries it, or notes it
+    // for one which measures it; called right before every send
+    using Stamp = void (*)(ByteSpan datagram, const Peer& peer, Clock::time_point now);
+
+    static constexpr double MEMBERSHIP_RATE = 10;   // datagrams per second and peer
+    static constexpr double MEMBERSHIP_BURST = 32;  // sent at once to one peer
+    static constexpr size_t MAX_QUEUED = 2 * MAX_PEERS;  // per priority, more are dropped
+
+    OutboundQueue(UdpSocket& socket, Reactor& reactor, Stamp stamp)
+        : socket(socket), reactor(reactor), stamp(stamp) {}
+    OutboundQueue(const OutboundQueue& other) = delete;
+    OutboundQueue& operator=(const OutboundQueue& other) = delete;
+
+    // Encodes the message into the socket's send buffer and sends it
+    template <typename M>
+    void send_to(const M& message, const Peer& peer) {
+        ByteSpan buffer = socket.send_buffer();
+        send_to(ByteSpan{buffer.data, encode(message, buffer)}, peer);
+    }
+    // The datagram is stamped in place and copied only if it has to wait
+    void send_to(ByteSpan datagram, const Peer& peer);
+
+    template <typename M>
+    void send_many(const M& message, const Peer* peers, size_t count) {
+        ByteSpan buffer = socket.send_buffer();
+        send_many(ByteSpan{buffer.data, encode(message, buffer)}, peers, count);
+    }
+    void send_many(ByteSpan datagram, const Peer* peers, size_t count);
+
+    ByteSpan send_buffer() { return socket.send_buffer(); }
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& queue : queues)
+            total += queue.size();
+        return total;
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<std::vector<uint8_t>> datagram;  // shared by a send_many
+        Peer peer;
+    };
+
+    struct Bucket {
+        double tokens = MEMBERSHIP_BURST;
+        Clock::time_point refilled;
+    };
+
+    // Sends right away unless something is waiting already, and queues
+    // what the socket doesn't take
+    void send_now(ByteSpan datagram, const Peer* peers, size_t count, Clock::time_point now);
+    void enqueue(ByteView datagram, const Peer* peers, size_t count);
+    void wait();
+    bool take_token(const Peer& peer, Clock::time_point now);
+    // Sends what waits, up to SEND_BATCH datagrams per sendmmsg, until the
+    // queues are empty or the socket is full again
+    void flush();
+
+    UdpSocket& socket;
+    Reactor& reactor;
+    Stamp stamp;
+    bool waiting = false;  // for the socket to become writable; nothing is queued otherwise
+    std::array<std::deque<Entry>, PRIORITY_COUNT> queues;  // by Priority
+    std::unordered_map<Peer, Bucket, PeerHash> buckets;
+
+    // A batch being flushed
+    std::array<ByteView, SEND_BATCH> batch_datagrams;
+    std::array<Peer, SEND_BATCH> batch_peers;
+};
+
+#endif // OUTBOUND_QUEUE_HPP
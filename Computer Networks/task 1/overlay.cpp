@@ -0,0 +1,122 @@
+#include "overlay.hpp"
+
+// An unknown round trip counts as the longest
+static uint64_t rank(int64_t round_trip) {
+    return round_trip < 0 ? UINT64_MAX : static_cast<uint64_t>(round_trip);
+}
+
+bool ParentSet::better(const Parent& a, const Parent& b) {
+    if (a.level != b.level)
+        return a.level < b.level;
+    return rank(a.round_trip) < rank(b.round_trip);
+}
+
+Parent* ParentSet::find(const Peer& peer) {
+    for (size_t i = 0; i < count; ++i) {
+        if (parents[i].peer == peer)
+            return &parents[i];
+    }
+    return nullptr;
+}
+
+Parent* ParentSet::offer(const Peer& peer, uint8_t level, TimePoint now) {
+    Parent* slot = nullptr;
+    if (count < TREE_PARENTS) {
+        slot = &parents[count++];
+    } else {
+        Parent* worst = &parents[0];
+        for (size_t i = 1; i < count; ++i) {
+            if (better(*worst, parents[i]))
+                worst = &parents[i];
+        }
+        if (level >= worst->level)
+            return nullptr;
+        slot = worst;
+    }
+    *slot = Parent();
+    slot->peer = peer;
+    slot->level = level;
+    slot->heard = now;
+    return slot;
+}
+
+void ParentSet::remove(const Peer& peer) {
+    Parent* parent = find(peer);
+    if (parent != nullptr)
+        *parent = parents[--count];
+}
+
+void ParentSet::prune(TimePoint since, uint8_t level) {
+    for (size_t i = 0; i < count;) {
+        if (parents[i].heard < since || parents[i].level >= level)
+            parents[i] = parents[--count];
+        else
+            ++i;
+    }
+}
+
+Parent* ParentSet::best() {
+    if (count == 0)
+        return nullptr;
+    Parent* best = &parents[0];
+    for (size_t i = 1; i < count; ++i) {
+        if (better(parents[i], *best))
+            best = &parents[i];
+    }
+    return best;
+}
+
+bool ChildSet::contains(const Peer& peer) const {
+    for (size_t i = 0; i < count; ++i) {
+        if (peers[i] == peer)
+            return true;
+    }
+    return false;
+}
+
+void ChildSet::note(const Peer& peer, int64_t round_trip, TimePoint now) {
+    size_t slot = count;
+    bool added = false;
+    for (size_t i = 0; i < count; ++i) {
+        if (peers[i] == peer) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == count) {
+        if (count == TREE_CHILDREN) {
+            size_t slowest = 0;
+            for (size_t i = 1; i < count; ++i) {
+                if (rank(round_trips[i]) > rank(round_trips[slowest]))
+                    slowest = i;
+            }
+            if (rank(round_trip) >= rank(round_trips[slowest]))
+                return;
+            slot = slowest;
+        } else {
+            ++count;
+        }
+        peers[slot] = peer;
+        added = true;
+    }
+    // A request which doesn't follow our SYNC_START tells nothing about the round trip
+    if (round_trip >= 0 || added)
+        round_trips[slot] = round_trip;
+    heard[slot] = now;
+}
+
+void ChildSet::expire(TimePoint since) {
+    for (size_t i = 0; i < count;) {
+        if (heard[i] < since)
+            erase(i);
+        else
+            ++i;
+    }
+}
+
+void ChildSet::erase(size_t i) {
+    --count;
+    peers[i] = peers[count];
+    round_trips[i] = round_trips[count];
+    heard[i] = heard[count];
+}
@@ -0,0 +1,82 @@
+#ifndef OVERLAY_HPP
+#define OVERLAY_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "message.hpp"
+
+// In tree mode every node syncs with at most TREE_PARENTS parents and sends
+// SYNC_START to at most TREE_CHILDREN children, plus TREE_PROBES random
+// peers per round, so that its load doesn't grow with the network
+constexpr size_t TREE_PARENTS = 3;
+constexpr size_t TREE_CHILDREN = 8;
+constexpr size_t TREE_PROBES = 2;
+
+using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+
+// A node we exchange SYNC_START / DELAY_REQUEST / DELAY_RESPONSE with
+struct Parent {
+    Peer peer;
+    uint8_t level = 255;
+    int64_t round_trip = -1;  // of the last exchange, -1 before the first one
+    TimePoint heard;          // last SYNC_START
+    // The exchange in progress
+    bool pending = false;
+    int64_t t1 = 0;
+    int64_t t2 = 0;
+    int64_t t3 = 0;
+};
+
+// The parents, best first by level and then by round trip
+class ParentSet {
+public:
+    Parent* find(const Peer& peer);
+    // Adds a parent, replacing the worst one if there is no room and the
+    // new one has a lower level; returns nullptr if it isn't added
+    Parent* offer(const Peer& peer, uint8_t level, TimePoint now);
+    void remove(const Peer& peer);
+    // Removes the parents not heard from since `since` or with a level
+    // of at least `level`
+    void prune(TimePoint since, uint8_t level);
+
+    // nullptr if there are no parents
+    Parent* best();
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+private:
+    static bool better(const Parent& a, const Parent& b);
+
+    std::array<Parent, TREE_PARENTS> parents;
+    size_t count = 0;
+};
+
+// The nodes which sync with us, kept by DELAY_REQUEST and ranked by the
+// round trip from our SYNC_START to their DELAY_REQUEST
+class ChildSet {
+public:
+    bool contains(const Peer& peer) const;
+    // Records a DELAY_REQUEST; round_trip is -1 if it doesn't follow our
+    // SYNC_START. A new child is added if there is room or it is faster
+    // than the slowest child, which it then replaces.
+    void note(const Peer& peer, int64_t round_trip, TimePoint now);
+    // Removes the children without DELAY_REQUEST since `since`
+    void expire(TimePoint since);
+
+    size_t size() const { return count; }
+    const Peer* begin() const { return peers.data(); }
+    const Peer* end() const { return peers.data() + count; }
+
+private:
+    void erase(size_t i);
+
+    std::array<Peer, TREE_CHILDREN> peers;  // contiguous for send_many
+    std::array<int64_t, TREE_CHILDREN> round_trips;
+    std::array<TimePoint, TREE_CHILDREN> heard;
+    size_t count = 0;
+};
+
+#endif // OVERLAY_HPP
@@ -0,0 +1,86 @@
+#include "peer_cache.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+bool load_peer_cache(const std::string& path, PeerCache& cache) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    ByteView in{data.data(), data.size()};
+
+    size_t offset = PEER_CACHE_MAGIC.size();
+    if (in.size < offset + 1 || !std::equal(PEER_CACHE_MAGIC.begin(), PEER_CACHE_MAGIC.end(), in.data))
+        return false;
+    cache.has_parent = in.data[offset] != 0;
+    if (cache.has_parent) {
+        size_t size = decode_peer(ByteView{in.data + offset, in.size - offset}, cache.parent);
+        if (size == 0)
+            return false;
+        offset += size;
+    } else {
+        ++offset;
+    }
+
+    if (in.size < offset + 4)
+        return false;
+    size_t count = get_u32(in.data + offset);
+    offset += 4;
+    if (count > MAX_PEERS)
+        return false;
+    cache.peers.resize(count);
+    for (Peer& peer : cache.peers) {
+        size_t size = decode_peer(ByteView{in.data + offset, in.size - offset}, peer);
+        if (size == 0)
+            return false;
+        offset += size;
+    }
+    return offset == in.size;
+}
+
+bool save_peer_cache(const std::string& path, const Peer* peers, size_t count, const Peer* parent) {
+    std::vector<uint8_t> data(PEER_CACHE_MAGIC.size() + IPV6_PEER_RECORD_SIZE + 4 +
+                              count * IPV6_PEER_RECORD_SIZE);
+    std::copy(PEER_CACHE_MAGIC.begin(), PEER_CACHE_MAGIC.end(), data.begin());
+    size_t offset = PEER_CACHE_MAGIC.size();
+    if (parent != nullptr) {
+        offset += encode_peer(data.data() + offset, *parent);
+    } else {
+        data[offset++] = 0;
+    }
+    put_u32(data.data() + offset, static_cast<uint32_t>(count));
+    offset += 4;
+    for (size_t i = 0; i < count; ++i)
+        offset += encode_peer(data.data() + offset, peers[i]);
+
+    // The data is on disk before the rename makes it the cache, so a crash
+    // leaves either the old cache or the new one, never a truncated file
+    std::string temporary = path + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+    bool written = true;
+    for (size_t done = 0; written && done < offset;) {
+        ssize_t n = ::write(fd, data.data() + done, offset - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        written = n > 0;
+        if (written)
+            done += static_cast<size_t>(n);
+    }
+    written = written && ::fsync(fd) == 0;
+    // close can report a failed write too
+    written = ::close(fd) == 0 && written;
+    if (!written || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        ::unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
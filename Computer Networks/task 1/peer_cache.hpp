@@ -0,0 +1,31 @@
+#ifndef PEER_CACHE_HPP
+#define PEER_CACHE_HPP
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "message.hpp"
+
+// The peers and the last sync parent, saved so that a restarted node can
+// send CONNECT to them instead of joining the network again.
+//
+// The file starts with PEER_CACHE_MAGIC, then the parent as a peer record
+// (as in HELLO_REPLY) or a 0 length octet, a 4-octet count and that many
+// peer records.
+constexpr std::array<uint8_t, 8> PEER_CACHE_MAGIC = {'P', 'T', 'S', 'P', 'E', 'E', 'R', 'S'};
+
+struct PeerCache {
+    std::vector<Peer> peers;
+    bool has_parent = false;
+    Peer parent;
+};
+
+// Returns false if the file doesn't exist or isn't a valid cache
+bool load_peer_cache(const std::string& path, PeerCache& cache);
+// Writes and syncs a temporary file and renames it, so that a node stopped
+// (or a machine crashing) while saving leaves the previous cache. Returns
+// false on an error, after removing the temporary file.
+bool save_peer_cache(const std::string& path, const Peer* peers, size_t count, const Peer* parent);
+
+#endif // PEER_CACHE_HPP
@@ -0,0 +1,72 @@
+#include "peer_table.hpp"
+
+PeerTable::PeerTable() {
+    // Reserve a few buckets up front, so that a growing network
+    // doesn't rehash on every doubling while it is small
+    index.reserve(1024);
+}
+
+bool PeerTable::contains(const Address& address, uint16_t port) const {
+    return index.find(Peer(address, port)) != index.end();
+}
+
+bool PeerTable::insert(const Peer& peer) {
+    if (full())
+        return false;
+
+    auto [it, inserted] = index.emplace(peer, count);
+    if (!inserted)
+        return false;
+
+    peers[count++] = peer;
+    return true;
+}
+
+bool PeerTable::erase(const Address& address, uint16_t port) {
+    auto it = index.find(Peer(address, port));
+    if (it == index.end())
+        return false;
+
+    size_t position = it->second;
+    index.erase(it);
+
+    // Fill the gap with the last peer and fix its position in the index
+    if (position != --count) {
+        peers[position] = peers[count];
+        index[peers[position]] = position;
+    }
+    return true;
+}
+
+void PeerTable::clear() {
+    index.clear();
+    count = 0;
+}
+
+SharedPeerSet::SharedPeerSet() : slots(new Slot[SLOTS]) {}
+
+void SharedPeerSet::insert(const Peer& peer) {
+    uint64_t key = tag(peer.address, peer.port);
+    for (size_t i = slot(key);; i = (i + 1) % SLOTS) {
+        uint64_t current = slots[i].tag.load(std::memory_order_relaxed);
+        if (current == key && slots[i].peer == peer)
+            return;
+        if (current == 0) {
+            // Readers see the peer once they see its tag
+            slots[i].peer = peer;
+            slots[i].tag.store(key, std::memory_order_release);
+            return;
+        }
+    }
+}
+
+bool SharedPeerSet::contains(const Address& address, uint16_t port) const {
+    uint64_t key = tag(address, port);
+    for (size_t i = slot(key);; i = (i + 1) % SLOTS) {
+        uint64_t current = slots[i].tag.load(std::memory_order_acquire);
+        if (current == key && slots[i].peer == Peer(address, port))
+            return true;
+        if (current == 0)
+            return false;
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef PEER_TABLE_HPP
+#define PEER_TABLE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
+#include "message.hpp"
+
+// Hash of (address, port); both halves of the address are mixed in, as
+// the first one is the same for all IPv4 peers
+inline uint64_t peer_hash(const Address& address, uint16_t port) {
+    uint64_t high;
+    uint64_t low;
+    memcpy(&high, address.data(), sizeof(high));
+    memcpy(&low, address.data() + sizeof(high), sizeof(low));
+    uint64_t hash = (high * 0x9E3779B97F4A7C15ull) ^ low ^ port;
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+    return hash ^ (hash >> 31);
+}
+
+struct PeerHash {
+    size_t operator()(const Peer& peer) const {
+        return static_cast<size_t>(peer_hash(peer.address, peer.port));
+    }
+};
+
+// Known peers, kept in insertion order in an array, with a hash index
+// on (address, port), so that membership checks don't scan the array
+class PeerTable {
+public:
+    PeerTable();
+
+    bool contains(const Address& address, uint16_t port) const;
+    // Returns false if the peer is already known or the table is full
+    bool insert(const Peer& peer);
+    // Removes the peer by moving the last one into its place,
+    // returns false if it wasn't known
+    bool erase(const Address& address, uint16_t port);
+    void clear();
+
+    size_t size() const { return count; }
+    bool full() const { return count == MAX_PEERS; }
+    const Peer& operator[](size_t i) const { return peers[i]; }
+    const Peer* begin() const { return peers.data(); }
+    const Peer* end() const { return peers.data() + count; }
+
+private:
+    std::array<Peer, MAX_PEERS> peers;
+    size_t count = 0;
+    std::unordered_map<Peer, size_t, PeerHash> index;  // peer -> position in peers
+};
+
+// Membership of the peer table for the receiver threads: one thread inserts,
+// any thread looks up without locking. Peers are never removed from the
+// peer table, so this is insert-only - open addressing over slots holding
+// a peer and its hash. The hash is atomic and stored after the peer, which
+// never changes afterwards; 0 marks an empty slot.
+class SharedPeerSet {
+public:
+    SharedPeerSet();
+
+    // Must only be called from one thread
+    void insert(const Peer& peer);
+    bool contains(const Address& address, uint16_t port) const;
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> tag{0};  // the peer's hash, never 0 once set
+        Peer peer;
+    };
+
+    // Twice MAX_PEERS, so that probe sequences stay short when it is full
+    static constexpr unsigned SLOT_BITS = 17;
+    static constexpr size_t SLOTS = size_t(1) << SLOT_BITS;
+    static_assert(SLOTS >= 2 * MAX_PEERS, "SharedPeerSet is too small for MAX_PEERS");
+
+    static uint64_t tag(const Address& address, uint16_t port) {
+        return peer_hash(address, port) | 1;
+    }
+    static size_t slot(uint64_t tag) {
+        return tag >> (64 - SLOT_BITS);
+    }
+
+    std::unique_ptr<Slot[]> slots;
+};
+
+#endif // PEER_TABLE_HPP
@@ -0,0 +1,139 @@
+#include "reactor.hpp"
+
+#include <array>
+#include <cerrno>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+constexpr int MAX_EVENTS = 64;
+
+Reactor::Reactor() {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+        throw std::runtime_error("epoll_create1() failed: " + std::string(strerror(errno)));
+}
+
+Reactor::~Reactor() {
+    for (auto& [timer, armed] : timers)
+        close(timer);
+    close(epoll_fd);
+}
+
+void Reactor::watch(int fd, Handler on_readable) {
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+        throw std::runtime_error("epoll_ctl() failed: " + std::string(strerror(errno)));
+    handlers[fd] = std::move(on_readable);
+}
+
+void Reactor::unwatch(int fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    handlers.erase(fd);
+    writable_handlers.erase(fd);
+}
+
+static void set_events(int epoll_fd, int fd, uint32_t events) {
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0)
+        throw std::runtime_error("epoll_ctl() failed: " + std::string(strerror(errno)));
+}
+
+void Reactor::wait_writable(int fd, Handler on_writable) {
+    if (writable_handlers.count(fd) == 0)
+        set_events(epoll_fd, fd, EPOLLIN | EPOLLOUT);
+    writable_handlers[fd] = std::move(on_writable);
+}
+
+int Reactor::add_timer(Handler on_expired) {
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer < 0)
+        throw std::runtime_error("timerfd_create() failed: " + std::string(strerror(errno)));
+    timers[timer] = false;
+
+    // Reading the expiration count acknowledges the timer
+    watch(timer, [this, timer, on_expired = std::move(on_expired)]() {
+        uint64_t expirations;
+        if (read(timer, &expirations, sizeof(expirations)) != sizeof(expirations))
+            return;  // disarmed after it became readable
+        itimerspec remaining;
+        timerfd_gettime(timer, &remaining);
+        timers[timer] = remaining.it_value.tv_sec != 0 || remaining.it_value.tv_nsec != 0;
+        on_expired();
+    });
+    return timer;
+}
+
+static timespec to_timespec(std::chrono::milliseconds duration) {
+    timespec ts;
+    ts.tv_sec = duration.count() / 1000;
+    ts.tv_nsec = (duration.count() % 1000) * 1000000;
+    return ts;
+}
+
+void Reactor::arm(int timer, std::chrono::milliseconds first, std::chrono::milliseconds interval) {
+    itimerspec spec;
+    // A zero it_value would disarm the timer
+    spec.it_value = to_timespec(std::max(first, std::chrono::milliseconds(1)));
+    spec.it_interval = to_timespec(interval);
+    if (timerfd_settime(timer, 0, &spec, nullptr) < 0)
+        throw std::runtime_error("timerfd_settime() failed: " + std::string(strerror(errno)));
+    timers[timer] = true;
+}
+
+void Reactor::disarm(int timer) {
+    itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (timerfd_settime(timer, 0, &spec, nullptr) < 0)
+        throw std::runtime_error("timerfd_settime() failed: " + std::string(strerror(errno)));
+    timers[timer] = false;
+}
+
+bool Reactor::armed(int timer) const {
+    auto it = timers.find(timer);
+    return it != timers.end() && it->second;
+}
+
+void Reactor::run() {
+    std::array<epoll_event, MAX_EVENTS> events;
+    running = true;
+    while (running) {
+        int ready = epoll_wait(epoll_fd, events.data(), MAX_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("epoll_wait() failed: " + std::string(strerror(errno)));
+        }
+        for (int i = 0; i < ready && running; ++i) {
+            int fd = events[i].data.fd;
+            // Writing first: what waits to be sent goes out before reading
+            // more, which would only add to it
+            auto writable = writable_handlers.find(fd);
+            if ((events[i].events & EPOLLOUT) && writable != writable_handlers.end()) {
+                Handler on_writable = std::move(writable->second);
+                writable_handlers.erase(writable);
+                set_events(epoll_fd, fd, EPOLLIN);
+                on_writable();
+            }
+            if (!(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+                continue;
+            auto it = handlers.find(fd);
+            if (it != handlers.end())
+                it->second();
+        }
+    }
+}
+
+void Reactor::stop() {
+    running = false;
+}
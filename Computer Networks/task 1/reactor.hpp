@@ -0,0 +1,48 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+
+// Single-threaded event loop: calls a handler whenever one of the watched
+// descriptors becomes readable (or writable, if asked for) or one of the
+// timers expires. Timers are timerfds, so they fire on time no matter how
+// busy the sockets are.
+class Reactor {
+public:
+    using Handler = std::function<void()>;
+
+    Reactor();
+    ~Reactor();
+    Reactor(const Reactor& other) = delete;
+    Reactor& operator=(const Reactor& other) = delete;
+
+    // Calls on_readable every time fd has data to read
+    void watch(int fd, Handler on_readable);
+    // Must not be called for fd from its own handler
+    void unwatch(int fd);
+    // Calls on_writable once, the next time the watched fd can be written to
+    void wait_writable(int fd, Handler on_writable);
+
+    // Creates a disarmed timer and returns its id
+    int add_timer(Handler on_expired);
+    // Expires first after `first`, then every `interval` (once if it is zero)
+    void arm(int timer, std::chrono::milliseconds first,
+             std::chrono::milliseconds interval = std::chrono::milliseconds(0));
+    void disarm(int timer);
+    bool armed(int timer) const;
+
+    // Dispatches events until stop() is called from a handler
+    void run();
+    void stop();
+
+private:
+    int epoll_fd;
+    bool running = false;
+    std::unordered_map<int, Handler> handlers;  // fd -> handler
+    std::unordered_map<int, Handler> writable_handlers;
+    std::unordered_map<int, bool> timers;       // timer fd -> whether it is armed
+};
+
+#endif // REACTOR_HPP
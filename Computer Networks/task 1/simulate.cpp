@@ -0,0 +1,319 @@
+// Load test for peer-time-sync: launches a network of nodes on localhost,
+// makes the first one the leader and polls every node with GET_TIME,
+// reporting how fast the network synchronizes and how well
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "network.hpp"
+#include "message.hpp"
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+constexpr std::chrono::milliseconds POLL_INTERVAL = 1s;
+// How long a poll waits for the replies
+constexpr std::chrono::milliseconds POLL_TIMEOUT = 500ms;
+// Between starting consecutive nodes, so that each can join the network
+constexpr std::chrono::milliseconds LAUNCH_INTERVAL = 20ms;
+
+struct Options {
+    unsigned nodes = 50;
+    uint16_t base_port = 20000;
+    double delay = 0;   // ms
+    double jitter = 0;  // ms
+    double loss = 0;    // percent
+    unsigned seconds = 60;
+    unsigned threads = 1;
+    std::string mode = "mesh";
+    std::string binary = "./peer-time-sync";
+};
+
+// What a node answered in one poll
+struct Reading {
+    bool answered = false;
+    uint8_t sync_level = 255;
+    int64_t timestamp = 0;
+    uint32_t round_trip = 0;
+    uint32_t dispersion = 0;
+    Clock::time_point sent;
+    Clock::time_point received;
+    // When the node most likely read its clock
+    Clock::time_point middle() const { return sent + (received - sent) / 2; }
+};
+
+static volatile sig_atomic_t interrupted = 0;
+
+bool parse_arguments(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-h")
+            return false;
+        if (i + 1 >= argc) {
+            std::cerr << "Error: missing value for " << arg << "\n";
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "-n")
+            options.nodes = std::atoi(value.c_str());
+        else if (arg == "-p")
+            options.base_port = std::atoi(value.c_str());
+        else if (arg == "-d")
+            options.delay = std::atof(value.c_str());
+        else if (arg == "-j")
+            options.jitter = std::atof(value.c_str());
+        else if (arg == "-l")
+            options.loss = std::atof(value.c_str());
+        else if (arg == "-s")
+            options.seconds = std::atoi(value.c_str());
+        else if (arg == "-t")
+            options.threads = std::atoi(value.c_str());
+        else if (arg == "-m")
+            options.mode = value;
+        else if (arg == "-e")
+            options.binary = value;
+        else {
+            std::cerr << "Error: unknown argument: " << arg << "\n";
+            return false;
+        }
+    }
+    if (options.nodes < 1 || options.base_port < 1 ||
+        options.base_port + options.nodes - 1 > UINT16_MAX) {
+        std::cerr << "Error: nodes must be at least 1 and all their ports valid.\n";
+        return false;
+    }
+    if (options.delay < 0 || options.jitter < 0 || options.loss < 0 || options.loss > 100) {
+        std::cerr << "Error: delay and jitter must not be negative, loss must be 0–100.\n";
+        return false;
+    }
+    return true;
+}
+
+void print_usage() {
+    std::cout << "Usage:\n"
+              << "  ./simulate [-n nodes] [-p base_port] [-d delay_ms] [-j jitter_ms]\n"
+              << "             [-l loss_percent] [-s seconds] [-t threads] [-m mode] [-e binary]\n"
+              << "Options:\n"
+              << "  -n   Number of nodes (default: 50), on ports base_port and up\n"
+              << "  -p   Port of the first node, the leader (default: 20000)\n"
+              << "  -d   Delay of every datagram sent by a node (default: 0)\n"
+              << "  -j   Random variation of the delay (default: 0)\n"
+              << "  -l   Percentage of datagrams dropped (default: 0)\n"
+              << "  -s   How long to run after choosing the leader (default: 60)\n"
+              << "  -t   Receiver threads of every node (default: 1)\n"
+              << "  -m   Sync mode of every node, mesh or tree (default: mesh)\n"
+              << "  -e   Node executable (default: ./peer-time-sync)\n";
+}
+
+// Starts node i, which joins a random node started before it
+pid_t launch(const Options& options, unsigned i, std::mt19937& random) {
+    std::vector<std::string> args = {options.binary, "-b", "127.0.0.1",
+                                     "-p", std::to_string(options.base_port + i)};
+    if (i > 0) {
+        unsigned target = std::uniform_int_distribution<unsigned>(0, i - 1)(random);
+        args.insert(args.end(), {"-a", "127.0.0.1", "-r", std::to_string(options.base_port + target)});
+    }
+    if (options.delay > 0 || options.jitter > 0 || options.loss > 0) {
+        std::ostringstream impairment;
+        impairment << options.delay << "," << options.jitter << "," << options.loss;
+        args.insert(args.end(), {"-i", impairment.str()});
+    }
+    if (options.threads > 1) {
+        args.insert(args.end(), {"-t", std::to_string(options.threads)});
+    }
+    args.insert(args.end(), {"-m", options.mode});
+
+    pid_t pid = fork();
+    if (pid < 0)
+        throw std::runtime_error("fork() failed: " + std::string(strerror(errno)));
+    if (pid == 0) {
+        // Nodes don't outlive the simulator, however it ends
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        // The nodes' own logs would drown the report
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        std::vector<char*> argv;
+        for (std::string& arg : args)
+            argv.push_back(arg.data());
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+// Datagrams received and sent by the whole host, from /proc/net/snmp
+bool udp_counters(uint64_t& in, uint64_t& out) {
+    std::ifstream snmp("/proc/net/snmp");
+    std::string header, values;
+    while (std::getline(snmp, header) && std::getline(snmp, values)) {
+        if (header.rfind("Udp:", 0) != 0)
+            continue;
+        std::istringstream names(header), numbers(values);
+        std::string name, number;
+        in = out = 0;
+        while (names >> name && numbers >> number) {
+            if (name == "InDatagrams")
+                in = std::stoull(number);
+            else if (name == "OutDatagrams")
+                out = std::stoull(number);
+        }
+        return true;
+    }
+    return false;
+}
+
+// Asks every node for its time and sync statistics
+std::vector<Reading> poll(UdpSocket& socket, const Options& options, const std::vector<Peer>& nodes) {
+    std::vector<Reading> readings(nodes.size());
+    GetTimeExtended get_time{TIME_STATISTICS};
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        readings[i].sent = Clock::now();
+        socket.send_to(get_time, nodes[i]);
+    }
+
+    size_t answered = 0;
+    auto deadline = Clock::now() + POLL_TIMEOUT;
+    while (answered < nodes.size() && Clock::now() < deadline) {
+        size_t received = socket.recv_many();
+        for (size_t j = 0; j < received; ++j) {
+            Peer sender = socket.batch_sender(j);
+            TimeStatistics statistics;
+            size_t i = sender.port - options.base_port;
+            if (sender.port < options.base_port || i >= nodes.size() ||
+                !decode(socket.batch_datagram(j), statistics)) {
+                continue;
+            }
+            Reading& reading = readings[i];
+            if (reading.answered)
+                continue;
+            reading.answered = true;
+            reading.sync_level = statistics.synchronized;
+            reading.timestamp = statistics.timestamp;
+            reading.round_trip = statistics.round_trip;
+            reading.dispersion = statistics.dispersion;
+            reading.received = socket.batch_time(j);
+            ++answered;
+        }
+    }
+    return readings;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parse_arguments(argc, argv, options)) {
+        print_usage();
+        return 1;
+    }
+    std::signal(SIGINT, [](int) { interrupted = 1; });
+
+    std::mt19937 random{std::random_device{}()};
+    std::vector<pid_t> pids;
+    std::vector<Peer> nodes;
+    std::cout << "Starting " << options.nodes << " nodes" << std::endl;
+    for (unsigned i = 0; i < options.nodes && !interrupted; ++i) {
+        pids.push_back(launch(options, i, random));
+        nodes.push_back(Peer("127.0.0.1", options.base_port + i));
+        std::this_thread::sleep_for(LAUNCH_INTERVAL);
+    }
+
+    UdpSocket socket(0, "127.0.0.1", 0, 100000);
+    socket.enable_timestamps();
+    uint64_t own_packets = 0;
+
+    Leader leader{0};
+    socket.send_to(leader, nodes[0]);
+    auto start = Clock::now();
+    uint64_t in_before = 0, out_before = 0, in_after = 0, out_after = 0;
+    bool counters = udp_counters(in_before, out_before);
+
+    std::cout << std::fixed << std::setprecision(2);
+    double converged = -1;
+    // The last level each node reported, as lost replies say nothing new
+    std::vector<uint8_t> levels(nodes.size(), 255);
+    while (!interrupted && Clock::now() - start < std::chrono::seconds(options.seconds)) {
+        auto round_start = Clock::now();
+        std::vector<Reading> readings = poll(socket, options, nodes);
+        double elapsed = std::chrono::duration<double>(round_start - start).count();
+
+        // The leader's clock is the reference, extrapolated to when each node read its own
+        const Reading& reference = readings[0];
+        size_t answered = 0, synchronized = 0;
+        double error_sum = 0, error_max = 0, round_trip_sum = 0, dispersion_sum = 0;
+        for (size_t i = 0; i < readings.size(); ++i) {
+            const Reading& reading = readings[i];
+            own_packets += 1 + reading.answered;
+            if (!reading.answered)
+                continue;
+            ++answered;
+            levels[i] = reading.sync_level;
+            if (reading.sync_level == 255 || !reference.answered)
+                continue;
+            ++synchronized;
+            double expected = reference.timestamp + std::chrono::duration<double, std::milli>(
+                reading.middle() - reference.middle()).count();
+            double error = std::abs(reading.timestamp - expected);
+            error_sum += error;
+            error_max = std::max(error_max, error);
+            round_trip_sum += reading.round_trip;
+            dispersion_sum += reading.dispersion;
+        }
+        if (converged < 0 && std::count(levels.begin(), levels.end(), 255) == 0)
+            converged = elapsed;
+
+        double count = std::max<size_t>(synchronized, 1);
+        std::cout << std::setw(7) << elapsed << "s  answered " << answered << "/" << nodes.size()
+                  << "  synchronized " << synchronized
+                  << "  error mean " << error_sum / count << " ms max " << error_max << " ms"
+                  << "  round trip " << round_trip_sum / count << " ms"
+                  << "  dispersion " << dispersion_sum / count << " ms" << std::endl;
+
+        for (size_t i = 0; i < pids.size(); ++i) {
+            int status;
+            if (pids[i] > 0 && waitpid(pids[i], &status, WNOHANG) == pids[i]) {
+                std::cout << "Node " << i << " on port " << nodes[i].port << " exited" << std::endl;
+                pids[i] = -1;
+            }
+        }
+        std::this_thread::sleep_until(round_start + POLL_INTERVAL);
+    }
+    double duration = std::chrono::duration<double>(Clock::now() - start).count();
+    counters = counters && udp_counters(in_after, out_after);
+
+    for (pid_t pid : pids) {
+        if (pid > 0)
+            kill(pid, SIGTERM);
+    }
+    for (pid_t pid : pids) {
+        if (pid > 0)
+            waitpid(pid, nullptr, 0);
+    }
+
+    if (converged >= 0)
+        std::cout << "All nodes synchronized " << converged << " s after choosing the leader\n";
+    else
+        std::cout << "The nodes never all synchronized\n";
+    if (counters) {
+        // Host-wide counters, so the host should be otherwise idle
+        uint64_t packets = (in_after - in_before) + (out_after - out_before);
+        packets -= std::min(packets, own_packets);
+        std::cout << "UDP datagrams per second per node (sent + received): "
+                  << packets / duration / nodes.size() << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+#include "sync_snapshot.hpp"
+
+#include <cstring>
+
+void SyncSnapshot::publish(const SyncState& state) {
+    std::array<uint64_t, WORDS> copy{};
+    memcpy(copy.data(), &state, sizeof(state));
+
+    uint64_t start = sequence.load(std::memory_order_relaxed);
+    sequence.store(start + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < WORDS; ++i)
+        words[i].store(copy[i], std::memory_order_relaxed);
+    sequence.store(start + 2, std::memory_order_release);
+}
+
+SyncState SyncSnapshot::load() const {
+    std::array<uint64_t, WORDS> copy;
+    uint64_t before, after;
+    do {
+        before = sequence.load(std::memory_order_acquire);
+        for (size_t i = 0; i < WORDS; ++i)
+            copy[i] = words[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = sequence.load(std::memory_order_relaxed);
+    } while (before != after || (before & 1) != 0);
+
+    SyncState state;
+    // SyncState is trivially copyable, only its default member initializers make GCC warn
+    memcpy(static_cast<void*>(&state), copy.data(), sizeof(state));
+    return state;
+}
@@ -0,0 +1,46 @@
+#ifndef SYNC_SNAPSHOT_HPP
+#define SYNC_SNAPSHOT_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+
+#include "clock_filter.hpp"
+
+// What is needed to answer GET_TIME and DELAY_REQUEST
+struct SyncState {
+    uint8_t sync_level = 255;
+    SlewedOffset offset;
+    uint32_t round_trip = 0;  // reported in TimeStatistics
+    uint32_t dispersion = 0;
+
+    // The clock value we send for `natural` milliseconds since the start,
+    // corrected by the offset if synchronized
+    int64_t time(int64_t natural, SlewedOffset::TimePoint when) const {
+        return sync_level < 255 ? natural - offset.at(when) : natural;
+    }
+};
+
+// Sync state published by the thread which owns it, for the receiver
+// threads to read without locking. It is a seqlock: a reader retries
+// if the owner published while it was copying the state.
+class SyncSnapshot {
+public:
+    // Starts with the state of an unsynchronized node
+    SyncSnapshot() { publish(SyncState()); }
+
+    // Must only be called from the owner thread
+    void publish(const SyncState& state);
+    SyncState load() const;
+
+private:
+    static_assert(std::is_trivially_copyable<SyncState>::value,
+                  "SyncState is copied word by word");
+    static constexpr size_t WORDS = (sizeof(SyncState) + 7) / 8;
+
+    std::atomic<uint64_t> sequence{0};  // odd while publishing
+    std::array<std::atomic<uint64_t>, WORDS> words{};
+};
+
+#endif // SYNC_SNAPSHOT_HPP